@@ -0,0 +1,224 @@
+/* Running From The Night:
+Batches of (start, goal) route queries on one map, grouped by start and spread over every rank and thread */
+#ifndef BATCH_QUERY_H
+#define BATCH_QUERY_H
+
+#include <mpi.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "search_kernel.h"
+#include "stats.h"
+
+struct RouteQuery {
+    int index; // Line order in the query file, results are tagged with it
+    int start_x, start_y, goal_x, goal_y;
+};
+
+// Queries sharing a start, answered by one search
+struct QueryGroup {
+    size_t first, count; // Range of the sorted queries
+    long long work; // Estimated cells expanded, groups are handed out largest first
+};
+
+//Reads one "start_x start_y goal_x goal_y" query per line, blank lines and lines starting with # are skipped.
+//Returns false if the file can't be read or a line doesn't parse
+bool loadQueries(const char* path, std::vector<RouteQuery>& queries) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        const char* p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+        RouteQuery q;
+        q.index = (int)queries.size();
+        ok = sscanf(p, "%d %d %d %d", &q.start_x, &q.start_y, &q.goal_x, &q.goal_y) == 4;
+        queries.push_back(q);
+    }
+    fclose(f);
+    return ok;
+}
+
+//Sorts the queries by start and cuts them into one group per start, largest estimated work first. A group with
+//one query is one A* search, a bigger one a Dijkstra out to its farthest goal
+std::vector<QueryGroup> groupQueries(std::vector<RouteQuery>& queries) {
+    std::sort(queries.begin(), queries.end(), [](const RouteQuery& a, const RouteQuery& b) {
+        if (a.start_x != b.start_x) {
+            return a.start_x < b.start_x;
+        }
+        if (a.start_y != b.start_y) {
+            return a.start_y < b.start_y;
+        }
+        return a.index < b.index;
+    });
+    std::vector<QueryGroup> groups;
+    for (size_t q = 0; q < queries.size(); ) {
+        QueryGroup g = { q, 0, 0 };
+        long long reach = 0;
+        while (q < queries.size() && queries[q].start_x == queries[g.first].start_x && queries[q].start_y == queries[g.first].start_y) {
+            reach = std::max(reach, (long long)std::max(std::abs(queries[q].goal_x - queries[q].start_x), std::abs(queries[q].goal_y - queries[q].start_y)));
+            q++;
+        }
+        g.count = q - g.first;
+        g.work = g.count == 1 ? reach + 1 : (2 * reach + 1) * (2 * reach + 1);
+        groups.push_back(g);
+    }
+    std::stable_sort(groups.begin(), groups.end(), [](const QueryGroup& a, const QueryGroup& b) { return a.work > b.work; });
+    return groups;
+}
+
+// Answers groups with one search per start. goals is scratch the size of the grid, left all 0 between groups
+struct QueryWorker {
+    SearchState<int> search;
+    std::vector<unsigned char> goals;
+};
+
+//Answers one group, costs[k] is the cost of its k-th query, -1 if the goal can't be reached or a cell is off the grid
+void answerGroup(const PaddedGrid& grid, QueryWorker& worker, bool diagonal, const RouteQuery* queries, size_t count, int* costs) {
+    const RouteQuery& first = queries[0];
+    bool startInside = first.start_x >= 0 && first.start_x < grid.height && first.start_y >= 0 && first.start_y < grid.width;
+    std::vector<int> cells(count, -1);
+    int distinct = 0;
+    int anyGoal = -1;
+    if (worker.goals.size() != grid.step.size()) {
+        worker.goals.assign(grid.step.size(), 0);
+    }
+    for (size_t k = 0; k < count; k++) {
+        const RouteQuery& q = queries[k];
+        if (startInside && q.goal_x >= 0 && q.goal_x < grid.height && q.goal_y >= 0 && q.goal_y < grid.width) {
+            cells[k] = grid.cell(q.goal_x, q.goal_y);
+            distinct += worker.goals[cells[k]] == 0;
+            worker.goals[cells[k]] = 1;
+            anyGoal = cells[k];
+        }
+    }
+    if (distinct == 1) { // A* is much cheaper than settling everything around the start
+        int goal = searchToPoint(grid, worker.search, diagonal, first.start_x, first.start_y, grid.row(anyGoal), grid.col(anyGoal));
+        for (size_t k = 0; k < count; k++) {
+            costs[k] = cells[k] != -1 && goal != -1 ? worker.search.cost[goal] : -1;
+        }
+    } else if (distinct > 1) {
+        searchToCells(grid, worker.search, diagonal, first.start_x, first.start_y, worker.goals, distinct);
+        for (size_t k = 0; k < count; k++) {
+            costs[k] = cells[k] != -1 && worker.search.reached(cells[k]) ? worker.search.cost[cells[k]] : -1;
+        }
+    } else {
+        std::fill(costs, costs + count, -1);
+    }
+    for (size_t k = 0; k < count; k++) {
+        if (cells[k] != -1) {
+            worker.goals[cells[k]] = 0;
+        }
+    }
+}
+
+//Answers every query, each rank writing the ones it answered to <resultsPrefix><rank>.txt as "index start_x start_y
+//goal_x goal_y cost" lines, group by group as they finish. Ranks take chunks of groups from a counter on rank 0 with
+//an atomic fetch and add, so a rank that drew cheap groups comes back for more. The numThreads threads start once
+//and take groups one at a time from their rank's chunk, whichever finds it empty draws the next chunk (MPI calls are
+//serialized by the same lock, which needs MPI_THREAD_SERIALIZED). Returns the number of queries this rank answered
+long long runQueryBatch(const PaddedGrid& grid, bool diagonal, std::vector<RouteQuery>& queries, int numThreads, const char* resultsPrefix,
+            int world_rank) {
+    TRACE_SCOPE("runQueryBatch");
+    std::vector<QueryGroup> groups = groupQueries(queries);
+    FILE* out = NULL;
+    if (resultsPrefix != NULL) {
+        std::string path = std::string(resultsPrefix) + std::to_string(world_rank) + ".txt";
+        out = fopen(path.c_str(), "w");
+        if (out == NULL) {
+            printf("Could not write %s \n", path.c_str());
+        }
+    }
+
+    long long* next; // Next group to hand out, only allocated on rank 0
+    MPI_Win win;
+    STAT_MPI(MPI_CALL_WIN_ALLOCATE, MPI_Win_allocate(world_rank == 0 ? sizeof(long long) : 0, sizeof(long long), MPI_INFO_NULL, MPI_COMM_WORLD, &next, &win));
+    if (world_rank == 0) {
+        STAT_MPI(MPI_CALL_WIN_LOCK, MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win));
+        *next = 0;
+        STAT_MPI(MPI_CALL_WIN_UNLOCK, MPI_Win_unlock(0, win));
+    }
+    STAT_MPI(MPI_CALL_BARRIER, MPI_Barrier(MPI_COMM_WORLD));
+
+    int threadLevel;
+    MPI_Query_thread(&threadLevel);
+    if (threadLevel < MPI_THREAD_SERIALIZED && numThreads > 1) {
+        if (world_rank == 0) {
+            printf("This MPI can't be called from more than one thread, answering queries on one thread per rank \n");
+        }
+        numThreads = 1;
+    }
+    numThreads = std::max(numThreads, 1);
+    std::vector<QueryWorker> workers(numThreads);
+    std::mutex outMutex;
+    std::mutex chunkMutex;
+    long long answered = 0;
+    const long long chunk = 4 * numThreads; // Small enough to balance the tail, big enough to keep every thread busy
+    long long chunkNext = 0, chunkEnd = 0; // What is left of the chunk this rank drew last, under chunkMutex
+    bool drained = false; // Rank 0 has handed out every group
+    STAT_MPI(MPI_CALL_WIN_LOCK_ALL, MPI_Win_lock_all(0, win));
+
+    //Next group for the calling thread, -1 once every group is taken
+    auto nextGroup = [&]() -> long long {
+        std::lock_guard<std::mutex> lock(chunkMutex);
+        if (chunkNext == chunkEnd && !drained) {
+            if (out != NULL) { // The lines of the last chunk are written by now, apart from groups still running
+                std::lock_guard<std::mutex> outLock(outMutex);
+                fflush(out);
+            }
+            long long begin;
+            STAT_MPI(MPI_CALL_FETCH_AND_OP, MPI_Fetch_and_op(&chunk, &begin, MPI_LONG_LONG, 0, 0, MPI_SUM, win); MPI_Win_flush(0, win));
+            drained = begin >= (long long)groups.size();
+            if (!drained) {
+                chunkNext = begin;
+                chunkEnd = std::min(begin + chunk, (long long)groups.size());
+            }
+        }
+        return chunkNext < chunkEnd ? chunkNext++ : -1;
+    };
+    auto work = [&](QueryWorker& worker) {
+        std::vector<int> costs;
+        for (long long g = nextGroup(); g != -1; g = nextGroup()) {
+            const QueryGroup& group = groups[g];
+            costs.resize(group.count);
+            answerGroup(grid, worker, diagonal, &queries[group.first], group.count, &costs[0]);
+            std::lock_guard<std::mutex> lock(outMutex);
+            for (size_t k = 0; k < group.count && out != NULL; k++) {
+                const RouteQuery& q = queries[group.first + k];
+                fprintf(out, "%d %d %d %d %d %d\n", q.index, q.start_x, q.start_y, q.goal_x, q.goal_y, costs[k]);
+            }
+            answered += (long long)group.count;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < numThreads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            work(workers[t]);
+            statsFlushThread();
+        }));
+    }
+    work(workers[0]);
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    STAT_MPI(MPI_CALL_WIN_UNLOCK_ALL, MPI_Win_unlock_all(win));
+    STAT_MPI(MPI_CALL_WIN_FREE, MPI_Win_free(&win));
+    if (out != NULL) {
+        fclose(out);
+    }
+    return answered;
+}
+
+#endif
@@ -0,0 +1,475 @@
+/* Running From The Night:
+Benchmark suite: generates reproducible synthetic shadow maps, runs main under mpiexec over rank and
+thread counts for both strategies and writes the timings as CSV and JSON with strong and weak scaling tables.
+With --check-skeleton it instead checks the skeleton's legs against the grid search on the same maps */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "map_io.h"
+#include "search_kernel.h"
+#include "skeleton.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+// Timings of one run of main, all in milliseconds and the max over ranks
+struct BenchRun {
+    std::string series; // strong or weak
+    std::string kind;
+    int size;
+    std::string mode;
+    int ranks, threads, rep;
+    double total, init, antennas, search, broadcast;
+    long long cost; // -1 if no route was reported
+    bool ok;
+};
+
+//Random craters: filled discs of random radius
+std::vector<unsigned char> generateBlobs(int size, unsigned int seed) {
+    std::mt19937 rng(seed);
+    std::vector<unsigned char> shadowed((size_t)size * size, 0);
+    long long numBlobs = (long long)size * size / 640; // About the shadow density of the LRO tiles
+    int maxRadius = std::max(2, size / 400);
+    for (long long b = 0; b < numBlobs; b++) {
+        int cx = rng() % size, cy = rng() % size, r = 1 + rng() % (3 * maxRadius);
+        for (int i = std::max(0, cx - r); i < std::min(size, cx + r); i++) {
+            for (int j = std::max(0, cy - r); j < std::min(size, cy + r); j++) {
+                if ((i - cx) * (i - cx) + (j - cy) * (j - cy) < r * r) {
+                    shadowed[(size_t)i * size + j] = 1;
+                }
+            }
+        }
+    }
+    return shadowed;
+}
+
+//A perfect maze carved by a randomized depth first search, corridors cell cells wide
+std::vector<unsigned char> generateMaze(int size, unsigned int seed) {
+    std::mt19937 rng(seed);
+    int cell = std::max(4, size / 64);
+    int rows = size / (2 * cell), cols = size / (2 * cell);
+    std::vector<unsigned char> shadowed((size_t)size * size, 1);
+    std::vector<unsigned char> visited((size_t)rows * cols, 0);
+    std::vector<std::pair<int, int> > stack(1, std::make_pair(0, 0));
+    visited[0] = 1;
+    const int dirs[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+    while (!stack.empty()) {
+        int r = stack.back().first, c = stack.back().second;
+        for (int i = 0; i < cell; i++) { // Open the cell itself
+            for (int j = 0; j < cell; j++) {
+                shadowed[(size_t)(2 * r * cell + cell / 2 + i) * size + 2 * c * cell + cell / 2 + j] = 0;
+            }
+        }
+        int options[4], numOptions = 0;
+        for (int d = 0; d < 4; d++) {
+            int nr = r + dirs[d][0], nc = c + dirs[d][1];
+            if (nr >= 0 && nr < rows && nc >= 0 && nc < cols && !visited[(size_t)nr * cols + nc]) {
+                options[numOptions++] = d;
+            }
+        }
+        if (numOptions == 0) {
+            stack.pop_back();
+            continue;
+        }
+        int d = options[rng() % numOptions];
+        int nr = r + dirs[d][0], nc = c + dirs[d][1];
+        int x0 = std::min(r, nr) * 2 * cell + cell / 2, y0 = std::min(c, nc) * 2 * cell + cell / 2;
+        int x1 = std::max(r, nr) * 2 * cell + cell / 2 + cell, y1 = std::max(c, nc) * 2 * cell + cell / 2 + cell;
+        for (int i = x0; i < x1; i++) { // Knock down the wall between the two cells
+            for (int j = y0; j < y1; j++) {
+                shadowed[(size_t)i * size + j] = 0;
+            }
+        }
+        visited[(size_t)nr * cols + nc] = 1;
+        stack.push_back(std::make_pair(nr, nc));
+    }
+    return shadowed;
+}
+
+//Terminator-like bands: wavy north-south shadow bands with random gaps, thicker further east
+std::vector<unsigned char> generateBands(int size, unsigned int seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<unsigned char> shadowed((size_t)size * size, 0);
+    int numBands = 12;
+    for (int b = 0; b < numBands; b++) {
+        double centre = size * (b + 0.5) / numBands;
+        double thickness = size * (0.005 + 0.02 * b / numBands);
+        double phase = unit(rng) * 6.283, wavelength = size * (0.1 + 0.2 * unit(rng)), amplitude = size * 0.02;
+        int numGaps = 2 + rng() % 4;
+        std::vector<std::pair<int, int> > gaps;
+        for (int g = 0; g < numGaps; g++) {
+            int at = rng() % size;
+            gaps.push_back(std::make_pair(at, at + std::max(2, (int)(size * 0.01))));
+        }
+        for (int i = 0; i < size; i++) {
+            bool inGap = false;
+            for (size_t g = 0; g < gaps.size(); g++) {
+                inGap = inGap || (i >= gaps[g].first && i < gaps[g].second);
+            }
+            if (inGap) {
+                continue;
+            }
+            double c = centre + amplitude * std::sin(phase + 6.283 * i / wavelength);
+            for (int j = std::max(0, (int)(c - thickness / 2)); j < std::min(size, (int)(c + thickness / 2)); j++) {
+                shadowed[(size_t)i * size + j] = 1;
+            }
+        }
+    }
+    return shadowed;
+}
+
+//Writes the map for kind and size unless it's already there, returns its path
+std::string ensureMap(const std::string& kind, int size, unsigned int seed) {
+    char path[256];
+    snprintf(path, sizeof(path), "bench_%s_%d_%u.map", kind.c_str(), size, seed);
+    FILE* f = fopen(path, "rb");
+    if (f != NULL) {
+        fclose(f);
+        return path;
+    }
+    std::vector<unsigned char> shadowed;
+    if (kind == "maze") {
+        shadowed = generateMaze(size, seed);
+    } else if (kind == "bands") {
+        shadowed = generateBands(size, seed);
+    } else {
+        shadowed = generateBlobs(size, seed);
+    }
+    if (!saveMap(path, size, size, shadowed)) {
+        fprintf(stderr, "Could not write %s\n", path);
+    }
+    return path;
+}
+
+//Reads the per rank timer lines main prints and keeps the slowest rank of each
+void parseLine(const char* line, BenchRun& run) {
+    int rank;
+    double ms;
+    long long cost;
+    char what[64];
+    if (sscanf(line, "%d Ran in %lf milliseconds", &rank, &ms) == 2) {
+        run.total = std::max(run.total, ms);
+        run.ok = true;
+    } else if (sscanf(line, "%d Time spent %lf %63[a-z ]", &rank, &ms, what) == 3) {
+        if (strncmp(what, "initializing", 12) == 0) {
+            run.init = std::max(run.init, ms);
+        } else if (strncmp(what, "finding", 7) == 0) {
+            run.antennas = std::max(run.antennas, ms);
+        } else if (strncmp(what, "searching", 9) == 0) {
+            run.search = std::max(run.search, ms);
+        } else if (strncmp(what, "broadcasting", 12) == 0) {
+            run.broadcast = std::max(run.broadcast, ms);
+        }
+    } else if (strstr(line, "Full resolution route") != NULL && sscanf(strstr(line, "Cost:"), "Cost: %lld", &cost) == 1) {
+        run.cost = cost; // The refined cost wins over the coarse one
+    } else if (strstr(line, "with Cost:") != NULL && run.cost == -1 && sscanf(strstr(line, "Cost:"), "Cost: %lld", &cost) == 1) {
+        run.cost = cost;
+    } else if (strstr(line, "with cost") != NULL && sscanf(strstr(line, "with cost"), "with cost %lld", &cost) == 1) {
+        run.cost = cost;
+    }
+}
+
+//Walks a path from the skeleton and returns its cost on the grid, -1 if it isn't a connected path from from to to
+int pathCost(const PaddedGrid& grid, bool diagonal, const std::vector<std::pair<int, int> >& path, int from, int to) {
+    if (path.empty() || grid.cell(path.front().first, path.front().second) != from || grid.cell(path.back().first, path.back().second) != to) {
+        return -1;
+    }
+    int cost = 0;
+    for (size_t k = 1; k < path.size(); k++) {
+        int dx = std::abs(path[k].first - path[k - 1].first), dy = std::abs(path[k].second - path[k - 1].second);
+        int w = grid.step[grid.cell(path[k].first, path[k].second)];
+        if (w == 0 || dx > 1 || dy > 1 || dx + dy == 0 || (!diagonal && dx + dy == 2)) {
+            return -1;
+        }
+        cost += (dx + dy == 2) ? StepCost<int>::diagonal(w) : StepCost<int>::orthogonal(w);
+    }
+    return cost;
+}
+
+//Prices numLegs random legs between open cells of level with skeletonLeg and with the grid search, and expands each
+//with skeletonPath. Routes may differ where paths tie, so only the costs are compared. Returns the number of mismatches
+int checkSkeleton(const LitLevel& level, bool diagonal, int numLegs, unsigned int seed, const char* label) {
+    PaddedGrid grid = buildPaddedGrid(level, NULL, 0, level.height);
+    SkeletonRouter router;
+    router.graph = buildSkeleton(grid, diagonal);
+    std::vector<int> open;
+    for (int i = 0; i < grid.height; i++) {
+        for (int j = 0; j < grid.width; j++) {
+            if (grid.step[grid.cell(i, j)] != 0) {
+                open.push_back(grid.cell(i, j));
+            }
+        }
+    }
+    if (open.empty()) {
+        printf("%s: no open cells\n", label);
+        return 0;
+    }
+    std::mt19937 rng(seed);
+    SearchState<int> search;
+    int badCosts = 0, badRoutes = 0;
+    for (int q = 0; q < numLegs; q++) {
+        int from = open[rng() % open.size()], to = open[rng() % open.size()];
+        int goal = searchToPoint(grid, search, diagonal, grid.row(from), grid.col(from), grid.row(to), grid.col(to));
+        int expected = goal == -1 ? -1 : search.cost[goal];
+        if (skeletonLeg(router, grid, grid.row(from), grid.col(from), grid.row(to), grid.col(to)) != expected) {
+            badCosts++;
+        }
+        if (expected != -1 && pathCost(grid, diagonal, skeletonPath(router.graph, grid, router.search, from, to), from, to) != expected) {
+            badRoutes++;
+        }
+    }
+    printf("%s: %d legs, %d nodes for %d open cells%s, %d cost mismatches, %d bad routes\n", label, numLegs, router.graph.numNodes(),
+            (int)open.size(), skeletonPaysOff(router.graph, grid) ? "" : " (main searches the grid instead)", badCosts, badRoutes);
+    fflush(stdout);
+    return badCosts + badRoutes;
+}
+
+BenchRun runMain(const std::string& mpiexec, const std::string& exe, const std::string& extraArgs, const std::string& mapPath,
+            const std::string& mode, int ranks, int threads) {
+    BenchRun run;
+    run.ranks = ranks;
+    run.threads = threads;
+    run.mode = mode;
+    run.total = run.init = run.antennas = run.search = run.broadcast = 0;
+    run.cost = -1;
+    run.ok = false;
+    char command[1024];
+    snprintf(command, sizeof(command), "%s %d %s --map %s --threads %d %s %s", mpiexec.c_str(), ranks, exe.c_str(), mapPath.c_str(),
+            threads, mode == "b" ? "b" : "", extraArgs.c_str());
+    FILE* out = popen(command, "r");
+    if (out == NULL) {
+        return run;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), out) != NULL) {
+        parseLine(line, run);
+    }
+    run.ok = (pclose(out) == 0) && run.ok;
+    if (run.cost == INT_MAX) { // main reports INT_MAX when no rank found a route
+        run.cost = -1;
+    }
+    return run;
+}
+
+std::vector<int> parseInts(const char* list) {
+    std::vector<int> values;
+    for (const char* p = list; *p != 0; ) {
+        values.push_back(atoi(p));
+        const char* comma = strchr(p, ',');
+        p = comma == NULL ? p + strlen(p) : comma + 1;
+    }
+    return values;
+}
+
+std::vector<std::string> parseStrings(const char* list) {
+    std::vector<std::string> values;
+    std::string s(list);
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t comma = s.find(',', start);
+        if (comma == std::string::npos) {
+            comma = s.size();
+        }
+        values.push_back(s.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return values;
+}
+
+void writeRunJson(FILE* f, const BenchRun& r) {
+    fprintf(f, "{\"series\": \"%s\", \"map\": \"%s\", \"size\": %d, \"mode\": \"%s\", \"ranks\": %d, \"threads\": %d, \"rep\": %d, \"ok\": %s, "
+            "\"total_ms\": %.1f, \"init_ms\": %.1f, \"antennas_ms\": %.1f, \"search_ms\": %.1f, \"broadcast_ms\": %.1f, \"cost\": %lld}",
+            r.series.c_str(), r.kind.c_str(), r.size, r.mode.c_str(), r.ranks, r.threads, r.rep, r.ok ? "true" : "false",
+            r.total, r.init, r.antennas, r.search, r.broadcast, r.cost);
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> sizes = parseInts("316,1264,5058");
+    std::vector<int> ranks = parseInts("1,2,4");
+    std::vector<int> threads = parseInts("1");
+    std::vector<std::string> kinds = parseStrings("blobs,maze,bands");
+    std::vector<std::string> modes = parseStrings("vert,b");
+    int reps = 1;
+    int weakBase = 1264; // Size of the map at one rank for weak scaling, 0 skips it
+    unsigned int seed = 418;
+    std::string exe = "./main.exe";
+    std::string mpiexec = "mpiexec -n";
+    std::string extraArgs = "";
+    std::string out = "bench";
+    int checkLegs = 0; // --check-skeleton <legs> checks the skeleton instead of running main
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--sizes") == 0) {
+            sizes = parseInts(argv[i + 1]);
+        } else if (strcmp(argv[i], "--ranks") == 0) {
+            ranks = parseInts(argv[i + 1]);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            threads = parseInts(argv[i + 1]);
+        } else if (strcmp(argv[i], "--maps") == 0) {
+            kinds = parseStrings(argv[i + 1]);
+        } else if (strcmp(argv[i], "--modes") == 0) {
+            modes = parseStrings(argv[i + 1]);
+        } else if (strcmp(argv[i], "--reps") == 0) {
+            reps = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--weak-base") == 0) {
+            weakBase = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = (unsigned int)atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--exe") == 0) {
+            exe = argv[i + 1];
+        } else if (strcmp(argv[i], "--mpiexec") == 0) {
+            mpiexec = argv[i + 1];
+        } else if (strcmp(argv[i], "--args") == 0) {
+            extraArgs = argv[i + 1];
+        } else if (strcmp(argv[i], "--out") == 0) {
+            out = argv[i + 1];
+        } else if (strcmp(argv[i], "--check-skeleton") == 0) {
+            checkLegs = atoi(argv[i + 1]);
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // Every map at the 1/16 level main prices legs on and the 1/4 level, both connectivities, flat and with weights
+    if (checkLegs > 0) {
+        int mismatches = 0;
+        for (size_t k = 0; k < kinds.size(); k++) {
+            for (size_t s = 0; s < sizes.size(); s++) {
+                std::string mapPath = ensureMap(kinds[k], sizes[s], seed);
+                LitLevel full;
+                if (!loadMap(mapPath.c_str(), full)) {
+                    fprintf(stderr, "Could not read %s\n", mapPath.c_str());
+                    return 1;
+                }
+                std::vector<LitLevel> levels = buildLitPyramid(full);
+                for (int l = 0; l < 2; l++) {
+                    for (int weighted = 0; weighted < 2; weighted++) {
+                        LitLevel& level = levels[l];
+                        if (weighted) { // Stripes of weights 1 to 4, so there are rectangles of one weight to skip
+                            level.cost.resize(level.anyLit.size());
+                            for (size_t c = 0; c < level.cost.size(); c++) {
+                                level.cost[c] = (unsigned char)(1 + ((c / level.width) / 7 + (c % level.width) / 9) % 4);
+                            }
+                        }
+                        for (int diagonal = 0; diagonal < 2; diagonal++) {
+                            char label[256];
+                            snprintf(label, sizeof(label), "%s %d 1/%d%s%s", kinds[k].c_str(), sizes[s], level.factor, diagonal ? " d" : "", weighted ? " w" : "");
+                            mismatches += checkSkeleton(level, diagonal != 0, checkLegs, seed, label);
+                        }
+                    }
+                }
+            }
+        }
+        printf("%s\n", mismatches == 0 ? "The skeleton matches the grid search" : "The skeleton does not match the grid search");
+        return mismatches == 0 ? 0 : 1;
+    }
+
+    // Strong scaling runs every size at every rank count, weak scaling grows the map with the ranks
+    std::vector<BenchRun> runs;
+    for (size_t k = 0; k < kinds.size(); k++) {
+        for (size_t m = 0; m < modes.size(); m++) {
+            for (size_t t = 0; t < threads.size(); t++) {
+                for (size_t r = 0; r < ranks.size(); r++) {
+                    std::vector<std::pair<std::string, int> > series;
+                    for (size_t s = 0; s < sizes.size(); s++) {
+                        series.push_back(std::make_pair(std::string("strong"), sizes[s]));
+                    }
+                    if (weakBase > 0) {
+                        series.push_back(std::make_pair(std::string("weak"), (int)std::lround(weakBase * std::sqrt((double)ranks[r]))));
+                    }
+                    for (size_t s = 0; s < series.size(); s++) {
+                        std::string mapPath = ensureMap(kinds[k], series[s].second, seed);
+                        for (int rep = 0; rep < reps; rep++) {
+                            BenchRun run = runMain(mpiexec, exe, extraArgs, mapPath, modes[m], ranks[r], threads[t]);
+                            run.series = series[s].first;
+                            run.kind = kinds[k];
+                            run.size = series[s].second;
+                            run.rep = rep;
+                            printf("%s %s %d %s ranks %d threads %d: %.0f ms%s\n", run.series.c_str(), run.kind.c_str(), run.size, run.mode.c_str(),
+                                    run.ranks, run.threads, run.total, run.ok ? "" : " (failed)");
+                            fflush(stdout);
+                            runs.push_back(run);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    FILE* csv = fopen((out + ".csv").c_str(), "w");
+    if (csv == NULL) {
+        fprintf(stderr, "Could not write %s.csv\n", out.c_str());
+        return 1;
+    }
+    fprintf(csv, "series,map,size,mode,ranks,threads,rep,ok,total_ms,init_ms,antennas_ms,search_ms,broadcast_ms,cost\n");
+    for (size_t i = 0; i < runs.size(); i++) {
+        const BenchRun& r = runs[i];
+        fprintf(csv, "%s,%s,%d,%s,%d,%d,%d,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%lld\n", r.series.c_str(), r.kind.c_str(), r.size, r.mode.c_str(),
+                r.ranks, r.threads, r.rep, r.ok ? 1 : 0, r.total, r.init, r.antennas, r.search, r.broadcast, r.cost);
+    }
+    fclose(csv);
+
+    // Best of the repetitions per configuration, keyed by (series, map, size or weak, mode, threads) then ranks
+    std::map<std::string, std::map<int, BenchRun> > best;
+    for (size_t i = 0; i < runs.size(); i++) {
+        const BenchRun& r = runs[i];
+        if (!r.ok) {
+            continue;
+        }
+        char key[256];
+        snprintf(key, sizeof(key), "%s|%s|%d|%s|%d", r.series.c_str(), r.kind.c_str(), r.series == "weak" ? 0 : r.size, r.mode.c_str(), r.threads);
+        std::map<int, BenchRun>& byRanks = best[key];
+        if (byRanks.count(r.ranks) == 0 || r.total < byRanks[r.ranks].total) {
+            byRanks[r.ranks] = r;
+        }
+    }
+
+    FILE* json = fopen((out + ".json").c_str(), "w");
+    if (json == NULL) {
+        fprintf(stderr, "Could not write %s.json\n", out.c_str());
+        return 1;
+    }
+    fprintf(json, "{\n\"seed\": %u,\n\"runs\": [\n", seed);
+    for (size_t i = 0; i < runs.size(); i++) {
+        fprintf(json, "  ");
+        writeRunJson(json, runs[i]);
+        fprintf(json, "%s\n", i + 1 < runs.size() ? "," : "");
+    }
+    // Speedup is against the smallest rank count of the same configuration. Strong scaling efficiency is
+    // speedup over the rank ratio, weak scaling efficiency is the base time over the time (ideal is 1 for both)
+    const char* tables[2] = { "strong", "weak" };
+    for (int t = 0; t < 2; t++) {
+        fprintf(json, "],\n\"%s_scaling\": [\n", tables[t]);
+        bool first = true;
+        for (std::map<std::string, std::map<int, BenchRun> >::iterator it = best.begin(); it != best.end(); ++it) {
+            if (it->first.compare(0, strlen(tables[t]), tables[t]) != 0 || it->second.empty()) {
+                continue;
+            }
+            const BenchRun& base = it->second.begin()->second;
+            for (std::map<int, BenchRun>::iterator r = it->second.begin(); r != it->second.end(); ++r) {
+                double speedup = base.total / std::max(r->second.total, 1e-9);
+                double ratio = (double)r->first / base.ranks;
+                double efficiency = (t == 0) ? speedup / ratio : speedup;
+                fprintf(json, "%s  {\"map\": \"%s\", \"size\": %d, \"mode\": \"%s\", \"threads\": %d, \"ranks\": %d, \"total_ms\": %.1f, "
+                        "\"speedup\": %.3f, \"efficiency\": %.3f}", first ? "" : ",\n", r->second.kind.c_str(), r->second.size,
+                        r->second.mode.c_str(), r->second.threads, r->first, r->second.total, speedup, efficiency);
+                first = false;
+            }
+        }
+        fprintf(json, "\n");
+    }
+    fprintf(json, "]\n}\n");
+    fclose(json);
+    printf("Wrote %s.csv and %s.json\n", out.c_str(), out.c_str());
+    return 0;
+}
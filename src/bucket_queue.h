@@ -0,0 +1,89 @@
+/* Running From The Night:
+Bucketed priority queue for searches whose priorities are small integers */
+#ifndef BUCKET_QUEUE_H
+#define BUCKET_QUEUE_H
+
+#include <vector>
+
+// Drop in for std::priority_queue<T, std::vector<T>, std::greater<T> > when KeyOf gives an integer priority.
+// Keys live in a circular window of buckets starting at the current minimum, with non-unit weights a push
+// lands at most (max weight + 2) buckets ahead so the window stays small. A key outside the window grows it.
+template <typename T, typename KeyOf>
+class BucketQueue {
+public:
+    BucketQueue() : buckets(16), minKey(0), count(0) {}
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    void push(const T& item) {
+        int key = KeyOf()(item);
+        if (count == 0) {
+            minKey = key;
+        } else if (key < minKey) {
+            int maxKey = findMaxKey();
+            while (maxKey - key >= (int)buckets.size()) {
+                grow();
+            }
+            minKey = key;
+        }
+        while (key - minKey >= (int)buckets.size()) {
+            grow();
+        }
+        buckets[slot(key)].push_back(item);
+        count++;
+    }
+
+    const T& top() {
+        advance();
+        return buckets[slot(minKey)].back();
+    }
+
+    void pop() {
+        advance();
+        buckets[slot(minKey)].pop_back();
+        count--;
+    }
+
+private:
+    std::vector<std::vector<T> > buckets;
+    int minKey;
+    size_t count;
+
+    size_t slot(int key) const {
+        return (size_t)(key & (int)(buckets.size() - 1)); // Size is always a power of two
+    }
+
+    //Moves minKey forward to the first non-empty bucket
+    void advance() {
+        while (buckets[slot(minKey)].empty()) {
+            minKey++;
+        }
+    }
+
+    int findMaxKey() {
+        int key = minKey + (int)buckets.size() - 1;
+        while (buckets[slot(key)].empty()) {
+            key--;
+        }
+        return key;
+    }
+
+    //Doubles the window, rehashing every item into its new bucket
+    void grow() {
+        std::vector<std::vector<T> > old(buckets.size() * 2);
+        old.swap(buckets);
+        for (size_t b = 0; b < old.size(); b++) {
+            for (size_t k = 0; k < old[b].size(); k++) {
+                buckets[slot(KeyOf()(old[b][k]))].push_back(old[b][k]);
+            }
+        }
+    }
+};
+
+#endif
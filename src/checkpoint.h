@@ -0,0 +1,236 @@
+/* Running From The Night:
+Per rank checkpoints of the start candidates already searched, written in the background so a killed run can pick up where it was */
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <mpi.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+#include "stats.h"
+
+// Layout: 8 byte magic, uint64 key, then int32 numStarts, nextStart, bestCost, globalBest, chainLength, then
+// chainLength (x, y) int32 pairs of the best chain, then numStarts (cost, end row) int32 pairs
+const char CHECKPOINT_MAGIC[8] = { 'M', 'G', 'C', 'K', 'P', 'T', '1', 0 };
+
+struct CheckpointState {
+    unsigned long long key; // Hash of the map and every parameter the results depend on
+    int nextStart; // Start candidates before this one are done
+    int bestCost; // This rank's incumbent, INT_MAX until it has one
+    int globalBest; // Lowest incumbent any rank had reported when this was written, row mode drops starts that cost more
+    std::vector<std::pair<int, int> > bestChain; // Waypoints of the incumbent
+    std::vector<int> costs; // Per start candidate, -1 if it has no route (or isn't done)
+    std::vector<int> endRows; // Per start candidate, the row its route leaves on (b mode)
+
+    CheckpointState() : key(0), nextStart(0), bestCost(INT_MAX), globalBest(INT_MAX) {}
+
+    void begin(unsigned long long runKey, int numStarts) {
+        key = runKey;
+        nextStart = 0;
+        bestCost = INT_MAX;
+        globalBest = INT_MAX;
+        bestChain.clear();
+        costs.assign(numStarts, -1);
+        endRows.assign(numStarts, -1);
+    }
+};
+
+//Writes a checkpoint through a temporary file that is renamed over the old one, so a crash mid write leaves the
+//last complete checkpoint behind. Returns false if it couldn't be written
+bool writeCheckpoint(const std::string& path, const CheckpointState& state) {
+    std::string temp = path + ".tmp";
+    FILE* f = fopen(temp.c_str(), "wb");
+    if (f == NULL) {
+        return false;
+    }
+    int header[5] = { (int)state.costs.size(), state.nextStart, state.bestCost, state.globalBest, (int)state.bestChain.size() };
+    std::vector<int> body;
+    for (size_t k = 0; k < state.bestChain.size(); k++) {
+        body.push_back(state.bestChain[k].first);
+        body.push_back(state.bestChain[k].second);
+    }
+    for (size_t k = 0; k < state.costs.size(); k++) {
+        body.push_back(state.costs[k]);
+        body.push_back(state.endRows[k]);
+    }
+    fwrite(CHECKPOINT_MAGIC, 1, sizeof(CHECKPOINT_MAGIC), f);
+    fwrite(&state.key, sizeof(state.key), 1, f);
+    fwrite(header, sizeof(int), 5, f);
+    if (!body.empty()) {
+        fwrite(&body[0], sizeof(int), body.size(), f);
+    }
+    bool ok = ferror(f) == 0;
+    fclose(f);
+    if (!ok) {
+        remove(temp.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    remove(path.c_str()); // rename doesn't replace on Windows
+#endif
+    return rename(temp.c_str(), path.c_str()) == 0;
+}
+
+//Reads the checkpoint at path, returns false if there is none or it was written for another key or number of starts
+bool loadCheckpoint(const std::string& path, unsigned long long key, int numStarts, CheckpointState& state) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == NULL) {
+        return false;
+    }
+    char magic[8];
+    unsigned long long fileKey;
+    int header[5];
+    bool ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0
+            && fread(&fileKey, sizeof(fileKey), 1, f) == 1 && fileKey == key
+            && fread(header, sizeof(int), 5, f) == 5 && header[0] == numStarts && header[1] >= 0 && header[1] <= numStarts && header[4] >= 0;
+    if (ok) {
+        std::vector<int> body(2 * ((size_t)header[4] + numStarts));
+        ok = body.empty() || fread(&body[0], sizeof(int), body.size(), f) == body.size();
+        if (ok) {
+            state.begin(key, numStarts);
+            state.nextStart = header[1];
+            state.bestCost = header[2];
+            state.globalBest = header[3];
+            for (int k = 0; k < header[4]; k++) {
+                state.bestChain.push_back(std::make_pair(body[2 * k], body[2 * k + 1]));
+            }
+            for (int k = 0; k < numStarts; k++) {
+                state.costs[k] = body[2 * (header[4] + k)];
+                state.endRows[k] = body[2 * (header[4] + k) + 1];
+            }
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+// Writes checkpoints on a thread of its own so the search never waits on the disk. Only the latest snapshot
+// matters, one posted while the last is still being written replaces any that is waiting
+class CheckpointWriter {
+public:
+    CheckpointWriter() : intervalSeconds(60), pending(false), stopping(false), written(0) {}
+
+    ~CheckpointWriter() {
+        finish();
+    }
+
+    void start(const std::string& checkpointPath, double seconds) {
+        path = checkpointPath;
+        intervalSeconds = seconds;
+        last = std::chrono::steady_clock::now();
+        stopping = false;
+        worker = std::thread([this]() { run(); });
+    }
+
+    bool started() const {
+        return worker.joinable();
+    }
+
+    //True once intervalSeconds have passed since the last snapshot, cheap enough to ask after every start candidate
+    bool due() const {
+        return started() && std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count() >= intervalSeconds;
+    }
+
+    //Hands a copy of state to the writer thread
+    void post(const CheckpointState& state) {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshot = state;
+        pending = true;
+        last = std::chrono::steady_clock::now();
+        wake.notify_one();
+    }
+
+    //Writes whatever is still pending and stops the thread, returns the number of checkpoints written
+    int finish() {
+        if (started()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                wake.notify_one();
+            }
+            worker.join();
+        }
+        return written;
+    }
+
+private:
+    std::string path;
+    double intervalSeconds;
+    std::chrono::steady_clock::time_point last; // Of the last post
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    CheckpointState snapshot;
+    bool pending;
+    bool stopping;
+    int written;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this]() { return pending || stopping; });
+            if (pending) {
+                CheckpointState state;
+                std::swap(state, snapshot);
+                pending = false;
+                lock.unlock();
+                if (writeCheckpoint(path, state)) {
+                    written++;
+                } else {
+                    printf("Could not write the checkpoint %s \n", path.c_str());
+                }
+                lock.lock();
+            } else if (stopping) {
+                return;
+            }
+        }
+    }
+};
+
+// Lowest incumbent any rank has reported, kept on rank 0. Ranks report with a one sided MPI_MIN when they
+// checkpoint, so nobody waits for a rank that is still busy
+class GlobalIncumbent {
+public:
+    GlobalIncumbent() : best(NULL), win(MPI_WIN_NULL) {}
+
+    //Collective over MPI_COMM_WORLD
+    void open(int world_rank) {
+        STAT_MPI(MPI_CALL_WIN_ALLOCATE, MPI_Win_allocate(world_rank == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &best, &win));
+        if (world_rank == 0) {
+            STAT_MPI(MPI_CALL_WIN_LOCK, MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win));
+            *best = INT_MAX;
+            STAT_MPI(MPI_CALL_WIN_UNLOCK, MPI_Win_unlock(0, win));
+        }
+        STAT_MPI(MPI_CALL_BARRIER, MPI_Barrier(MPI_COMM_WORLD));
+        STAT_MPI(MPI_CALL_WIN_LOCK_ALL, MPI_Win_lock_all(0, win));
+    }
+
+    //Reports this rank's incumbent, returns the lowest one reported so far by any rank
+    int report(int local) {
+        int before;
+        STAT_MPI(MPI_CALL_FETCH_AND_OP, MPI_Fetch_and_op(&local, &before, MPI_INT, 0, 0, MPI_MIN, win); MPI_Win_flush(0, win));
+        return std::min(before, local);
+    }
+
+    //Collective over MPI_COMM_WORLD
+    void close() {
+        if (win != MPI_WIN_NULL) {
+            STAT_MPI(MPI_CALL_WIN_UNLOCK_ALL, MPI_Win_unlock_all(win));
+            STAT_MPI(MPI_CALL_WIN_FREE, MPI_Win_free(&win));
+        }
+    }
+
+private:
+    int* best;
+    MPI_Win win;
+};
+
+#endif
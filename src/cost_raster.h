@@ -0,0 +1,207 @@
+/* Running From The Night:
+Per cell traversal costs (slope, shadow proximity, antenna line of sight) precomputed into a uint8 raster */
+#ifndef COST_RASTER_H
+#define COST_RASTER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <utility>
+#include "pyramid.h"
+#include "coverage.h"
+#include "search_kernel.h"
+
+// The kernels below work on whole rows with no branches in the inner loop so -O3 vectorizes them
+
+struct CostParams {
+    float metersPerCell; // Size of a full resolution cell (LPSR_85S_060M is 60 m/pixel)
+    int gradePerStep; // Every this many percent of grade adds 1 to the cost
+    int maxGrade; // Grades above this cost the maximum
+    int shadowRadius; // Cells closer than this (in full resolution cells) to a shadow are penalized, 1 per cell closer
+    int losBonus; // Taken off the cost of cells an antenna can see
+};
+
+CostParams defaultCostParams() {
+    CostParams params;
+    params.metersPerCell = 60.0f;
+    params.gradePerStep = 5;
+    params.maxGrade = 35;
+    params.shadowRadius = 8;
+    params.losBonus = 2;
+    return params;
+}
+
+//Loads a raw little endian int16 elevation raster (meters), returns an empty raster if the file doesn't match
+std::vector<short> loadElevation(const char* path, int height, int width) {
+    std::vector<short> dem((size_t)height * width);
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return std::vector<short>();
+    }
+    size_t got = fread(&dem[0], sizeof(short), dem.size(), f);
+    fclose(f);
+    if (got != dem.size()) {
+        return std::vector<short>();
+    }
+    return dem;
+}
+
+//Averages the elevation over factor x factor blocks to match a pyramid level
+Raster<short> downsampleElevation(const Raster<short>& dem, int height, int width, int factor) {
+    if (factor == 1) {
+        return dem;
+    }
+    int h = (height + factor - 1) / factor;
+    int w = (width + factor - 1) / factor;
+    std::vector<int> sums((size_t)h * w, 0);
+    std::vector<int> counts((size_t)h * w, 0);
+    for (int i = 0; i < height; i++) {
+        const short* in = &dem[(size_t)i * width];
+        int* sumRow = &sums[(size_t)(i / factor) * w];
+        int* countRow = &counts[(size_t)(i / factor) * w];
+        for (int j = 0; j < width; j++) {
+            sumRow[j / factor] += in[j];
+            countRow[j / factor]++;
+        }
+    }
+    std::vector<short> out((size_t)h * w);
+    for (size_t k = 0; k < out.size(); k++) {
+        out[k] = (short)(sums[k] / counts[k]);
+    }
+    return out;
+}
+
+//Slope penalty of one row from the steeper of the east and south rises
+void slopeCostRow(const short* __restrict row, const short* __restrict below, int width, int riseScale, int maxPenalty, unsigned char* __restrict out) {
+    for (int j = 0; j < width - 1; j++) {
+        int east = std::abs(row[j + 1] - row[j]);
+        int south = std::abs(below[j] - row[j]);
+        int rise = std::max(east, south);
+        out[j] = (unsigned char)std::min((rise * riseScale) >> 8, maxPenalty);
+    }
+    out[width - 1] = out[width > 1 ? width - 2 : 0];
+}
+
+//Slope penalty for a whole level, rise in meters is turned into grade steps with 8 bits of fixed point
+std::vector<unsigned char> slopeCost(const Raster<short>& dem, int height, int width, float metersPerCell, const CostParams& params) {
+    std::vector<unsigned char> out((size_t)height * width, 0);
+    int riseScale = (int)(256.0f * 100.0f / (metersPerCell * params.gradePerStep));
+    int maxPenalty = params.maxGrade / params.gradePerStep + 1;
+    for (int i = 0; i < height; i++) {
+        const short* below = &dem[(size_t)std::min(i + 1, height - 1) * width];
+        slopeCostRow(&dem[(size_t)i * width], below, width, riseScale, maxPenalty, &out[(size_t)i * width]);
+    }
+    return out;
+}
+
+//Manhattan distance to the nearest shadowed cell, capped at cap. The vertical passes run a whole row at a time,
+//the horizontal passes are scans along each row
+std::vector<unsigned char> shadowDistance(const Raster<unsigned char>& lit, int height, int width, int cap) {
+    std::vector<unsigned char> dist((size_t)height * width);
+    for (int j = 0; j < width; j++) {
+        dist[j] = (unsigned char)(lit[j] ? cap : 0);
+    }
+    for (int i = 1; i < height; i++) { // Top down
+        const unsigned char* __restrict litRow = &lit[(size_t)i * width];
+        const unsigned char* __restrict above = &dist[(size_t)(i - 1) * width];
+        unsigned char* __restrict out = &dist[(size_t)i * width];
+        for (int j = 0; j < width; j++) {
+            out[j] = (unsigned char)(litRow[j] ? std::min((int)above[j] + 1, cap) : 0);
+        }
+    }
+    for (int i = height - 2; i >= 0; i--) { // Bottom up
+        const unsigned char* __restrict below = &dist[(size_t)(i + 1) * width];
+        unsigned char* __restrict out = &dist[(size_t)i * width];
+        for (int j = 0; j < width; j++) {
+            out[j] = (unsigned char)std::min((int)out[j], below[j] + 1);
+        }
+    }
+    for (int i = 0; i < height; i++) {
+        unsigned char* out = &dist[(size_t)i * width];
+        for (int j = 1; j < width; j++) {
+            out[j] = (unsigned char)std::min((int)out[j], out[j - 1] + 1);
+        }
+        for (int j = width - 2; j >= 0; j--) {
+            out[j] = (unsigned char)std::min((int)out[j], out[j + 1] + 1);
+        }
+    }
+    return dist;
+}
+
+//Takes the nearest a full resolution cell of each block gets to a shadow, so every level charges the same
+//penalty for the same ground
+std::vector<unsigned char> shadowDistanceForLevel(const std::vector<unsigned char>& fullDist, const LitLevel& full, const LitLevel& level) {
+    if (level.factor == 1) {
+        return fullDist;
+    }
+    std::vector<unsigned char> out((size_t)level.height * level.width, 255);
+    for (int i = 0; i < full.height; i++) {
+        const unsigned char* in = &fullDist[(size_t)i * full.width];
+        unsigned char* row = &out[(size_t)(i / level.factor) * level.width];
+        for (int j = 0; j < full.width; j++) {
+            row[j / level.factor] = std::min(row[j / level.factor], in[j]);
+        }
+    }
+    return out;
+}
+
+//Combines the terms into the final cost, always at least 1 so the manhattan heuristic stays admissible
+void combineCostRow(const unsigned char* __restrict slope, const unsigned char* __restrict shadowDist, const unsigned char* __restrict covered,
+            int width, int shadowRadius, int losBonus, unsigned char* __restrict out) {
+    for (int j = 0; j < width; j++) {
+        int c = 1 + slope[j] + (shadowRadius - shadowDist[j]) - losBonus * covered[j];
+        out[j] = (unsigned char)std::min(std::max(c, 1), 255);
+    }
+}
+
+//Builds the cost raster of a level from its distances to shadow in full resolution cells (see shadowDistanceForLevel).
+//dem and coverage may be empty (no slope term, no line of sight bonus)
+std::vector<unsigned char> buildCostRaster(const LitLevel& level, const std::vector<unsigned char>& dist, const Raster<short>& dem, const std::vector<unsigned char>& coverage,
+            const CostParams& params) {
+    size_t n = (size_t)level.height * level.width;
+    std::vector<unsigned char> slope(n, 0);
+    if (!dem.empty()) {
+        slope = slopeCost(dem, level.height, level.width, params.metersPerCell * level.factor, params);
+    }
+    std::vector<unsigned char> covered(coverage);
+    if (covered.empty()) {
+        covered.assign(n, 0);
+    }
+    std::vector<unsigned char> cost(n);
+    for (int i = 0; i < level.height; i++) {
+        size_t row = (size_t)i * level.width;
+        combineCostRow(&slope[row], &dist[row], &covered[row], level.width, params.shadowRadius, params.losBonus, &cost[row]);
+    }
+    return cost;
+}
+
+//Fills in the cost raster of every level of the pyramid from a full resolution elevation raster and
+//a full resolution antenna coverage raster (either may be empty)
+void applyCostModel(std::vector<LitLevel>& levels, const Raster<short>& fullDem, const std::vector<unsigned char>& fullCoverage, const CostParams& params) {
+    const LitLevel& full = levels.back();
+    std::vector<unsigned char> fullDist = shadowDistance(full.allLit, full.height, full.width, params.shadowRadius);
+    for (size_t l = 0; l < levels.size(); l++) {
+        Raster<short> dem;
+        if (!fullDem.empty()) {
+            dem = downsampleElevation(fullDem, full.height, full.width, levels[l].factor);
+        }
+        std::vector<unsigned char> coverage;
+        if (!fullCoverage.empty()) {
+            coverage = coverageForLevel(fullCoverage, full, levels[l]);
+        }
+        levels[l].cost = buildCostRaster(levels[l], shadowDistanceForLevel(fullDist, full, levels[l]), dem, coverage, params);
+    }
+}
+
+//Sums the cost of stepping along path (the first cell is free), diagonal steps cost as they do in the search kernel
+int routeCost(const LitLevel& level, const std::vector<std::pair<int, int> >& path) {
+    int total = 0;
+    for (size_t p = 1; p < path.size(); p++) {
+        int w = level.cost.empty() ? 1 : level.cost[(size_t)path[p].first * level.width + path[p].second];
+        bool diagonal = path[p].first != path[p - 1].first && path[p].second != path[p - 1].second;
+        total += diagonal ? StepCost<int>::diagonal(w) : StepCost<int>::orthogonal(w);
+    }
+    return total;
+}
+
+#endif
@@ -0,0 +1,217 @@
+/* Running From The Night:
+Antenna coverage: viewsheds over an elevation raster by a horizon sweep, stored as packed bitmaps */
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <utility>
+#include "pyramid.h"
+
+struct CoverageParams {
+    float radiusMeters; // Range of an antenna
+    float antennaHeight; // Meters above the ground
+    float metersPerCell; // Size of a full resolution cell
+    int maxPerGroup; // Candidates kept per antenna group after ranking
+    float minLitFraction; // Candidates covering less than this fraction of their lit surroundings are dropped
+    int numThreads; // Threads per rank (--threads) for the viewshed computation, the batch query workers and scanBand
+};
+
+CoverageParams defaultCoverageParams() {
+    CoverageParams params;
+    params.radiusMeters = 10000.0f;
+    params.antennaHeight = 3.0f;
+    params.metersPerCell = 60.0f;
+    params.maxPerGroup = 64;
+    params.minLitFraction = 0.0f;
+    params.numThreads = 1;
+    return params;
+}
+
+// Visible cells of a (2 * radius + 1)^2 window centred on the site, one bit per cell
+struct Viewshed {
+    int x, y;
+    int radius;
+    int litCovered; // Lit cells in sight
+    int litTotal; // Lit cells in range
+    std::vector<unsigned long long> bits;
+
+    bool visible(int i, int j) const {
+        size_t k = (size_t)(i - x + radius) * (2 * radius + 1) + (j - y + radius);
+        return (bits[k >> 6] >> (k & 63)) & 1;
+    }
+};
+
+// The rays to every cell on the perimeter of the window all take exactly radius steps, so the sweep moves
+// every ray forward one step at a time. The per ray state is kept in arrays so the inner loop runs across rays
+struct RayFan {
+    int radius;
+    std::vector<int> stepX, stepY; // 16.16 fixed point increments per step
+    std::vector<float> stepLen; // Horizontal distance per step in cells
+    std::vector<float> invStepLen;
+};
+
+RayFan buildRayFan(int radius) {
+    RayFan fan;
+    fan.radius = radius;
+    for (int k = -radius; k < radius; k++) { // Walk the perimeter once, corners included once
+        int ends[4][2] = { { -radius, k }, { k, radius }, { radius, -k }, { -k, -radius } };
+        for (int e = 0; e < 4; e++) {
+            fan.stepX.push_back((ends[e][0] * 65536) / radius);
+            fan.stepY.push_back((ends[e][1] * 65536) / radius);
+            fan.stepLen.push_back(std::sqrt((float)(ends[e][0] * ends[e][0] + ends[e][1] * ends[e][1])) / radius);
+            fan.invStepLen.push_back(1.0f / fan.stepLen.back());
+        }
+    }
+    return fan;
+}
+
+//Computes the viewshed of one site. dem is full resolution, NULL treats the surface as flat (pure coverage radius)
+void computeViewshed(const short* dem, const LitLevel& full, const RayFan& fan, float antennaHeight, float metersPerCell, Viewshed& out) {
+    int r = fan.radius;
+    int side = 2 * r + 1;
+    size_t numRays = fan.stepX.size();
+    out.radius = r;
+    out.bits.assign(((size_t)side * side + 63) / 64, 0);
+    out.litCovered = 0;
+    out.litTotal = 0;
+    float z0 = (dem != NULL ? dem[(size_t)out.x * full.width + out.y] : 0) + antennaHeight;
+
+    std::vector<float> horizon(numRays, -1e30f);
+    std::vector<int> cellX(numRays), cellY(numRays);
+    std::vector<unsigned char> seen(numRays);
+    for (int s = 1; s <= r; s++) {
+        float invDist = 1.0f / (s * metersPerCell);
+        for (size_t k = 0; k < numRays; k++) { // Step every ray, no branches
+            int cx = out.x + ((fan.stepX[k] * s + 32768) >> 16);
+            int cy = out.y + ((fan.stepY[k] * s + 32768) >> 16);
+            int inside = (cx >= 0) & (cx < full.height) & (cy >= 0) & (cy < full.width) & (fan.stepLen[k] * s <= (float)r);
+            int safeX = std::min(std::max(cx, 0), full.height - 1);
+            int safeY = std::min(std::max(cy, 0), full.width - 1);
+            float z = (dem != NULL ? dem[(size_t)safeX * full.width + safeY] : 0);
+            float slope = (z - z0) * fan.invStepLen[k] * invDist;
+            seen[k] = (unsigned char)(inside & (slope >= horizon[k]));
+            horizon[k] = inside ? std::max(horizon[k], slope) : horizon[k];
+            cellX[k] = cx;
+            cellY[k] = cy;
+        }
+        for (size_t k = 0; k < numRays; k++) { // Scatter the visible cells into the bitmap
+            if (seen[k]) {
+                size_t bit = (size_t)(cellX[k] - out.x + r) * side + (cellY[k] - out.y + r);
+                out.bits[bit >> 6] |= 1ULL << (bit & 63);
+            }
+        }
+    }
+    out.bits[((size_t)r * side + r) >> 6] |= 1ULL << (((size_t)r * side + r) & 63); // The site itself
+
+    for (int i = std::max(out.x - r, 0); i <= std::min(out.x + r, full.height - 1); i++) {
+        for (int j = std::max(out.y - r, 0); j <= std::min(out.y + r, full.width - 1); j++) {
+            if (full.anyLit[(size_t)i * full.width + j]) {
+                out.litTotal++;
+                out.litCovered += out.visible(i, j);
+            }
+        }
+    }
+}
+
+//Computes the viewsheds of all sites (full resolution coordinates) spread over numThreads threads
+std::vector<Viewshed> computeViewsheds(const short* dem, const LitLevel& full, const std::vector<std::pair<int, int> >& sites, const CoverageParams& params) {
+    int radius = std::max(1, (int)(params.radiusMeters / params.metersPerCell));
+    RayFan fan = buildRayFan(radius);
+    std::vector<Viewshed> sheds(sites.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < std::max(params.numThreads, 1); t++) {
+        workers.push_back(std::thread([&]() {
+            for (size_t s = next++; s < sites.size(); s = next++) {
+                sheds[s].x = sites[s].first;
+                sheds[s].y = sites[s].second;
+                computeViewshed(dem, full, fan, params.antennaHeight, params.metersPerCell, sheds[s]);
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    return sheds;
+}
+
+//Marks every cell seen by one of the viewsheds on a full resolution raster
+std::vector<unsigned char> coverageRaster(const LitLevel& full, const std::vector<Viewshed>& sheds) {
+    std::vector<unsigned char> covered((size_t)full.height * full.width, 0);
+    for (size_t s = 0; s < sheds.size(); s++) {
+        const Viewshed& v = sheds[s];
+        for (int i = std::max(v.x - v.radius, 0); i <= std::min(v.x + v.radius, full.height - 1); i++) {
+            for (int j = std::max(v.y - v.radius, 0); j <= std::min(v.y + v.radius, full.width - 1); j++) {
+                covered[(size_t)i * full.width + j] |= (unsigned char)v.visible(i, j);
+            }
+        }
+    }
+    return covered;
+}
+
+//Downsamples a full resolution coverage raster to a level, a cell is covered if any of its block is
+std::vector<unsigned char> coverageForLevel(const std::vector<unsigned char>& covered, const LitLevel& full, const LitLevel& level) {
+    if (level.factor == 1) {
+        return covered;
+    }
+    std::vector<unsigned char> out((size_t)level.height * level.width, 0);
+    for (int i = 0; i < full.height; i++) {
+        const unsigned char* in = &covered[(size_t)i * full.width];
+        unsigned char* row = &out[(size_t)(i / level.factor) * level.width];
+        for (int j = 0; j < full.width; j++) {
+            row[j / level.factor] |= in[j];
+        }
+    }
+    return out;
+}
+
+//Full resolution sites of the antenna candidates (level coordinates), the centre of their block
+std::vector<std::pair<int, int> > coverageSites(const std::vector<std::vector<std::pair<int, int> > >& antennaList, const std::vector<int>& counts,
+            const LitLevel& level, const LitLevel& full) {
+    std::vector<std::pair<int, int> > sites;
+    for (size_t g = 0; g < counts.size(); g++) {
+        for (int k = 0; k < counts[g]; k++) {
+            int x = std::min(antennaList[g][k].first * level.factor + level.factor / 2, full.height - 1);
+            int y = std::min(antennaList[g][k].second * level.factor + level.factor / 2, full.width - 1);
+            sites.push_back(std::make_pair(x, y));
+        }
+    }
+    return sites;
+}
+
+//Ranks the antenna candidates of every group by the lit cells they can see and keeps the best maxPerGroup.
+//Candidates are in level coordinates and are looked at from the centre of their block at full resolution.
+//Returns the viewsheds of the candidates that were kept
+std::vector<Viewshed> rankAntennasByCoverage(std::vector<std::vector<std::pair<int, int> > >& antennaList, std::vector<int>& counts,
+            const LitLevel& level, const LitLevel& full, const short* dem, const CoverageParams& params) {
+    std::vector<Viewshed> sheds = computeViewsheds(dem, full, coverageSites(antennaList, counts, level, full), params);
+
+    std::vector<Viewshed> kept;
+    size_t first = 0;
+    for (size_t g = 0; g < counts.size(); g++) {
+        std::vector<std::pair<int, int> > order; // (-lit cells covered, candidate) so the best sort first
+        for (int k = 0; k < counts[g]; k++) {
+            const Viewshed& v = sheds[first + k];
+            if (v.litCovered >= params.minLitFraction * v.litTotal) {
+                order.push_back(std::make_pair(-v.litCovered, k));
+            }
+        }
+        std::stable_sort(order.begin(), order.end());
+        int keep = std::min((int)order.size(), params.maxPerGroup);
+        std::vector<std::pair<int, int> > ranked(keep);
+        for (int k = 0; k < keep; k++) {
+            ranked[k] = antennaList[g][order[k].second];
+            kept.push_back(sheds[first + order[k].second]);
+        }
+        std::copy(ranked.begin(), ranked.end(), antennaList[g].begin());
+        first += counts[g];
+        counts[g] = keep;
+    }
+    return kept;
+}
+
+#endif
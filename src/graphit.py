@@ -2,20 +2,48 @@ from PIL import Image
 
 import matplotlib.pyplot as plt
 import numpy as np
+import struct
+import sys
 
-f = open("16x16path.txt")
-s = f.read()
-print(s)
-A = s.split("-> ")
-print(A)
-x = []
-y = []
-for i in range(len(A) - 1):
-    print(A[i])
-    j = A[i].split(",")
-    print(j)
-    x.append(int(j[0][1:]))
-    y.append(int(j[1][:-1]))
+# Moves of the route format written by main.exe --route (see route_io.h), indexed by the top 3 bits of a run
+ROUTE_MOVES = [(-1, 0), (1, 0), (0, -1), (0, 1), (-1, -1), (-1, 1), (1, -1), (1, 1)]
+
+# Reads a .route file, returns the rows and columns of every cell in full resolution coordinates
+def read_route(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != b"MGROUTE1":
+        raise ValueError(path + " is not a route file")
+    factor, x, y = struct.unpack("<iii", data[8:20])
+    x_list = [x]
+    y_list = [y]
+    for run in data[20:]:
+        dx, dy = ROUTE_MOVES[run >> 5]
+        for i in range((run & 31) + 1):
+            x += dx
+            y += dy
+            x_list.append(x)
+            y_list.append(y)
+    return [xi * factor for xi in x_list], [yi * factor for yi in y_list]
+
+# Reads the old "(x, y)-> " text dumps
+def read_text_path(path):
+    f = open(path)
+    s = f.read()
+    A = s.split("-> ")
+    x = []
+    y = []
+    for i in range(len(A) - 1):
+        j = A[i].split(",")
+        x.append(int(j[0][1:]))
+        y.append(int(j[1][:-1]))
+    return x, y
+
+path = sys.argv[1] if len(sys.argv) > 1 else "16x16path.txt"
+if path.endswith(".route"):
+    x, y = read_route(path)
+else:
+    x, y = read_text_path(path)
 
 # print(x,y)
 
@@ -25,7 +53,7 @@ altImg = np.copy(img[0:2529, 0:5058]) # New altimage size for width/height
 for i in range(len(x)):
     xi = x[i]
     yi = y[i]
-    # print(altImg)
-    altImg[xi][yi] = 16711680
+    if xi < altImg.shape[0] and yi < altImg.shape[1]:
+        altImg[xi][yi] = 16711680
 imgplot = plt.imshow(altImg)
 plt.show()
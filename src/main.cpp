@@ -10,100 +10,33 @@ Authors: Kevin Fang (kevinfan) and Nikolai Stefanov (nstefano) */
 #include <chrono>
 #include <string>
 #include <vector>
+#include <thread>
 #include <random>
-#include <stack>
 #include <queue>
 #include <ctime>
 #include <chrono>
 #include "shadow_map.h"
+#include "pyramid.h"
+#include "map_io.h"
+#include "route_io.h"
+#include "cost_raster.h"
+#include "coverage.h"
+#include "search_kernel.h"
+#include "stats.h"
+#include "result_cache.h"
+#include "batch_query.h"
+#include "node_shared.h"
+#include "checkpoint.h"
+#include "tile_store.h"
+#include "skeleton.h"
 using namespace std;
 
 #include <unordered_map>
 
-// Shortcut
-typedef std::pair<int, int> Pair;
-
-struct Node {
-    int x, y; // Node coordinates
-    float cost; // Cost to reach this node
-    float heuristic; // Heuristic estimate to the goal
-    Node* parent; // Pointer to parent node for path reconstruction
-    bool blocked;
-    bool shadowed;
-
-    // Comparator for priority queue
-    bool operator>(const Node& other) const {
-        return cost + heuristic > other.cost + other.heuristic;
-    }
-};
-
-//Returns if it is a valid direction for the A* algorithm
-bool validDirection(int x, int y, int dx, int dy, int image_width, int image_height, int startingHeight, int endingHeight) {
-    if (x + dx < startingHeight) {
-        return false;
-    } else if (x + dx >= endingHeight) {
-        return false;
-    }
-    if (y + dy < 0) {
-        return false;
-    } else if (y + dy >= image_width) {
-        return false;
-    }
-    return true;
-}
-
-
-//Returns if a location on the grid is good for an antenna
-bool goodForAntenna(int grid[5058][5058], std::vector<std::vector<Node> > routeMap, int image_width, int image_height, int x, int y) {
-    if (routeMap[x][y].shadowed == false) {
-        if (x + 1 < image_height && x - 1 >= 0) {
-            if (routeMap[x+1][y].shadowed == true || routeMap[x-1][y].shadowed == true) {//Either top or bottom are shadowed
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
-//Old code for finding antenna heights, left here for testing purposes
-std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > findAntennasHeight(int grid[5058][5058], std::vector<std::vector<Node> > routeMap, int startingHeight, int endingHeight, int startingWidth, int image_width, int image_height, int numAntennas) {
-    std::vector<std::vector<std::pair<int,int> > > antennaList(numAntennas, std::vector<std::pair<int, int> >(endingHeight - startingHeight));
-    std::vector<int> counts(numAntennas);
-    int sepBetAnt = image_width/numAntennas;
-    int count = 0;
-    int currRow = 0;
-    int sCol = startingWidth;
-    int subCurr = 0;
-    while (count < numAntennas) {
-        int currCounts = 0;
-        if (sCol > image_width || (sCol < startingWidth || subCurr >= sepBetAnt)) {
-            std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > r = make_pair(antennaList, counts);
-            return r;
-        }
-        for (int i = startingHeight; i < endingHeight; i++) {
-            if (goodForAntenna(grid, routeMap, image_width, image_height, i, sCol)) {
-                antennaList[count][currCounts].first = i;
-                antennaList[count][currCounts].second = sCol;
-                currCounts++;
-            }
-        }
-        if (currCounts > 0) {
-            counts[count] = currCounts;
-            count++;
-            currRow++;
-            sCol += sepBetAnt;
-            sCol = std::min(sCol, image_width);
-        } else {
-            subCurr++;
-            sCol++;
-        }
-    }
-    std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > r = make_pair(antennaList, counts);
-    return r;
-}
-
-//Finds the antenna heights to better balance workload, ensures that every thread looks through at most 30 columns
-std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > findAntennasHeightNew(int grid[5058][5058], std::vector<std::vector<Node> > routeMap, int startingHeight, int endingHeight, int startingWidth, int image_width, int image_height, int numAntennas) {
+//Finds the antenna heights to better balance workload, ensures that every thread looks through at most 30 columns.
+//The candidates of each column come from scanBand
+std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > findAntennasHeightNew(const std::vector<std::vector<int> >& candidateRows, int startingHeight, int endingHeight, int startingWidth, int image_width, int image_height, int numAntennas) {
+    TRACE_SCOPE("findAntennasHeightNew");
     int maxColCount = 30;
     std::vector<std::vector<std::pair<int,int> > > antennaList(numAntennas, std::vector<std::pair<int, int> >(maxColCount *(endingHeight - startingHeight)));
     std::vector<int> counts(numAntennas);
@@ -121,12 +54,11 @@ std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > fin
             std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > r = make_pair(antennaList, counts);
             return r;
         }
-        for (int i = startingHeight; i < endingHeight; i++) {
-            if (goodForAntenna(grid, routeMap, image_width, image_height, i, sCol)) {
-                antennaList[count][countCounts + currCounts].first = i;
-                antennaList[count][countCounts + currCounts].second = sCol;
-                currCounts++;
-            }
+        const std::vector<int>& rows = candidateRows[sCol];
+        for (size_t k = 0; k < rows.size(); k++) {
+            antennaList[count][countCounts + currCounts].first = rows[k];
+            antennaList[count][countCounts + currCounts].second = sCol;
+            currCounts++;
         }
 
         if (colCount >= maxColCount) {
@@ -155,8 +87,9 @@ std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > fin
     return r;
 }
 
-//Finds the antenna heights for the across columns approach
-std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > findAntennasHeightAcrossWidth(int grid[5058][5058], std::vector<std::vector<Node> > routeMap, int startingWidth, int endingWidth, int image_width, int image_height, int numAntennasPerProc) {
+//Finds the antenna heights for the across columns approach, the candidates of each column come from scanBand over every row
+std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > findAntennasHeightAcrossWidth(const std::vector<std::vector<int> >& candidateRows, int startingWidth, int endingWidth, int image_width, int image_height, int numAntennasPerProc) {
+    TRACE_SCOPE("findAntennasHeightAcrossWidth");
     int maxColCount = 30;
     int maxNumAntennas = 20;
     int placedAntennas = 0;
@@ -176,13 +109,12 @@ std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > fin
             std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > r = make_pair(antennaList, counts);
             return r;
         }
-        for (int i = 0; i < image_height; i++) {         
-            if (goodForAntenna(grid, routeMap, image_width, image_height, i, sCol)) {
-                antennaList[count][countCounts + currCounts].first = i;
-                antennaList[count][countCounts + currCounts].second = sCol;
-                placedAntennas++;
-                currCounts++;
-            }
+        const std::vector<int>& rows = candidateRows[sCol];
+        for (size_t k = 0; k < rows.size(); k++) {
+            antennaList[count][countCounts + currCounts].first = rows[k];
+            antennaList[count][countCounts + currCounts].second = sCol;
+            placedAntennas++;
+            currCounts++;
         }
 
         if (colCount >= maxColCount) {
@@ -216,330 +148,507 @@ std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > fin
 }
 
 
-//Calculates the heuristic according to manhattan distance
-int calcHeur(int x, int y, int goal_x, int goal_y) {
-    return std::abs(goal_x - x) + std::abs(goal_y - y);
+//Runs the typical A* algorithm, returning the cost of the path or -1 if the goal can't be reached
+int doAStar(const PaddedGrid& grid, SearchState<int>& search, bool diagonal, int start_x, int start_y, int goal_x, int goal_y) {
+    TRACE_SCOPE("doAStar");
+    int goal = searchToPoint(grid, search, diagonal, start_x, start_y, goal_x, goal_y);
+    return goal == -1 ? -1 : search.cost[goal];
 }
 
-
-//Prints the path 
-void printPath(std::vector<std::vector<Node> > routeMap, Node dest)
-{
-    printf("\nThe Path is ");
-    int row = dest.x;
-    int col = dest.y;
- 
-    stack<Pair> Path;
-    int i = 0;
-    while (!((*routeMap[row][col].parent).x == row
-             && (*routeMap[row][col].parent).y == col)) { //The source parent points to itself
-        Pair p = make_pair(row,col);
-        Path.push(p);
-        int temp_row = (*routeMap[row][col].parent).x;
-        int temp_col = (*routeMap[row][col].parent).y;
-        row = temp_row;
-        col = temp_col;
-        i++;
-    }
- 
-    Path.push(std::make_pair(row, col));
-    while (!Path.empty()) {
-        std::pair<int, int> p = Path.top();
-        Path.pop();
-        printf("->(%d,%d)", p.first, p.second);
-    }
-    printf("\n");
-    return;
+//doAStar through the result cache. Legs it already knows aren't searched again, neither are legs between open
+//cells with different labels (see labelComponents, empty labels always search). With a skeleton of the grid, legs
+//between open cells are priced on it instead. New legs are added to the cache
+int cachedAStar(ResultCache& cache, const std::vector<int>& labels, SkeletonRouter* skeleton, const PaddedGrid& grid, SearchState<int>& search, bool diagonal,
+            int start_x, int start_y, int goal_x, int goal_y) {
+    int from = start_x * grid.width + start_y;
+    int to = goal_x * grid.width + goal_y;
+    int c = cache.leg(from, to);
+    if (c != -2) {
+        return c;
+    }
+    int a = labels.empty() ? 0 : labels[grid.cell(start_x, start_y)];
+    int b = labels.empty() ? 0 : labels[grid.cell(goal_x, goal_y)];
+    c = (a != 0 && b != 0 && a != b) ? -1 : -2;
+    if (c == -2 && skeleton != NULL) {
+        c = skeletonLeg(*skeleton, grid, start_x, start_y, goal_x, goal_y);
+    }
+    if (c == -2) {
+        c = doAStar(grid, search, diagonal, start_x, start_y, goal_x, goal_y);
+    }
+    cache.addLeg(from, to, c);
+    return c;
 }
 
+// Everything a rank needs from its band of a pyramid level before it searches, see scanBand
+struct BandScan {
+    PaddedGrid grid; // The band's rows, see buildPaddedGrid
+    std::vector<std::vector<int> > candidateRows; // Per column, the band's lit rows next to a shadowed row above or below
+};
 
-//Checks if a path is blocked
-bool notBlocked(std::vector<std::vector<Node> > routeMap, int x, int y) {
-    return (routeMap[x][y].blocked == false);
-}
-
-//Counts the path from the start node to the destination node
-int countPath(std::vector<std::vector<Node> > routeMap, Node dest, int start_x, int start_y)
-{
-    int row = dest.x;
-    int col = dest.y;
+//Pads the search grid and finds the antenna candidates of every column of a pyramid level, only from
+//startingHeight to endingHeight, in one pass. Each of numThreads threads streams down a block of the band's rows,
+//so every cell is read once and a column is never rescanned. A row outside the band doesn't count as shadowed
+BandScan scanBand(const LitLevel& level, int startingHeight, int endingHeight, int numThreads) {
+    TRACE_SCOPE("scanBand");
+    BandScan band;
+    band.grid.height = level.height;
+    band.grid.width = level.width;
+    band.grid.top = std::min(std::max(startingHeight, 0), level.height);
+    band.grid.bottom = std::max(std::min(endingHeight, level.height), band.grid.top);
+    band.grid.stride = level.width + 2;
+    band.grid.step.assign((size_t)(band.grid.bottom - band.grid.top + 2) * band.grid.stride, 0);
+    const int top = band.grid.top, bottom = band.grid.bottom, width = level.width;
+
+    numThreads = std::max(std::min(numThreads, bottom - top), 1);
+    std::vector<std::vector<std::vector<int> > > found(numThreads, std::vector<std::vector<int> >(width)); // Per thread, per column
+    std::vector<std::thread> workers;
+    for (int t = 0; t < numThreads; t++) {
+        workers.push_back(std::thread([&, t]() {
+            for (int i = top + (bottom - top) * t / numThreads; i < top + (bottom - top) * (t + 1) / numThreads; i++) {
+                size_t row = (size_t)i * width;
+                const unsigned char* anyLit = &level.anyLit[row];
+                const unsigned char* allLit = &level.allLit[row];
+                const unsigned char* above = i - 1 >= top ? &level.allLit[row - width] : NULL;
+                const unsigned char* below = i + 1 < bottom ? &level.allLit[row + width] : NULL;
+                const unsigned char* cost = level.cost.empty() ? NULL : &level.cost[row];
+                bool inside = i - 1 >= 0 && i + 1 < level.height; // Antennas never go on the map's first or last row
+                unsigned char* step = &band.grid.step[band.grid.cell(i, 0)];
+                for (int j = 0; j < width; j++) {
+                    step[j] = anyLit[j] ? (cost == NULL ? 1 : cost[j]) : 0;
+                    if (inside && allLit[j] && ((above != NULL && !above[j]) || (below != NULL && !below[j]))) {
+                        found[t][j].push_back(i);
+                    }
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    STAT_ADD(candidatesScanned, (long long)(bottom - top) * width);
 
-    int i = 0;
-    while (!(row == start_x && col == start_y)) {    
-        if (routeMap[row][col].parent == NULL) {
-            return i;
+    band.candidateRows.resize(width);
+    for (int j = 0; j < width; j++) { // Threads took the rows in order, so each column's rows come out sorted
+        for (int t = 0; t < numThreads; t++) {
+            band.candidateRows[j].insert(band.candidateRows[j].end(), found[t][j].begin(), found[t][j].end());
         }
-        int temp_row = (*routeMap[row][col].parent).x;
-        int temp_col = (*routeMap[row][col].parent).y;
-        row = temp_row;
-        col = temp_col;
-        i++;
     }
-    return i;
+    return band;
 }
 
-//Runs the typical A* algorithm, returning the cost of the path and the updated routeMap
-std::pair<int, std::vector<std::vector<Node> > > doAStar(std::priority_queue<Node, std::vector<Node>, std::greater<Node> > frontier,  
-            std::vector<std::vector<Node> > routeMap, std::vector<std::vector<bool> > possiblePath,
-            std::unordered_map<int, Node> came_from, std::unordered_map<int, float> cost_so_far, int image_width, int image_height, int startingHeight, int endingHeight, int start_x, int start_y, int goal_x, int goal_y) {
-    Node startNode = frontier.top();
-    while (!frontier.empty()) {
-        Node current = frontier.top();
-        frontier.pop();
-        
-        // Check for goal
-        int x = current.x;
-        int y = current.y;
-
-
-        int newHeur, newCost;
-        // Expand to neighbors
-        for (int dx = -1; dx < 2; dx++) { //Rows
-            for (int dy = -1; dy < 2; dy++) { //Cols can only move forward
-                if (dx == 0 || dy == 0) { //Don't allow diagonals now
-                    if (validDirection(x, y, dx, dy, image_width, image_height, startingHeight, endingHeight)) {
-                        if (x + dx == goal_x && y + dy == goal_y) {
-                            Node n = routeMap[x+dx][y+dy];
-                            n.cost = newCost;
-                            n.heuristic = newHeur;
-                            n.x = x + dx;
-                            n.y = y + dy;
-                            routeMap[x + dx][y + dy] = n;
-                            routeMap[x + dx][y + dy].parent = &(routeMap[x][y]);
-                            return std::make_pair(countPath(routeMap, routeMap[x + dx][y + dy], start_x, start_y), routeMap);
-                        }
-                        else if ((!possiblePath[x+dx][y+dy]) && notBlocked(routeMap, x+dx, y+dy)) {
-                            newCost = routeMap[x][y].cost + 1;
-                            newHeur = calcHeur(x + dx, y + dy, goal_x, goal_y);
-
-                            if (routeMap[x + dx][y + dy].cost == -1 || routeMap[x + dx][y + dy].cost + routeMap[x + dx][y + dy].heuristic > newCost + newHeur) {
-                                Node n = routeMap[x+dx][y+dy];
-                                n.cost = newCost;
-                                n.heuristic = newHeur;
-                                n.x = x + dx;
-                                n.y = y + dy;
-                                n.parent = &(routeMap[x][y]);
-                                routeMap[x + dx][y + dy] = n;
-                                frontier.push(n);
-                                possiblePath[x+dx][y+dy] = true;
-                            }
-                        }
-                    }
-                }
-            }
+//Returns the path laid out by A* hitting each of the destinations in turn, start first. Empty if a leg can't be found
+std::vector<std::pair<int, int> > getAStarPath(const PaddedGrid& grid, SearchState<int>& search, bool diagonal, const std::vector<std::pair<int, int> >& destinations, int numAntennas) {
+    TRACE_SCOPE("getAStarPath");
+    std::vector<std::pair<int, int> > path(1, destinations[0]);
+    for (int dest = 0; dest < numAntennas; dest++) {
+        int goal = searchToPoint(grid, search, diagonal, destinations[dest].first, destinations[dest].second, destinations[dest + 1].first, destinations[dest + 1].second);
+        if (goal == -1) {
+            return std::vector<std::pair<int, int> >();
         }
+        std::vector<std::pair<int, int> > leg = tracePath(grid, search, goal);
+        path.insert(path.end(), leg.begin() + 1, leg.end()); // The leg's start is already on the path
     }
-    return std::make_pair(-1, routeMap);
+    return path;
 }
 
-//Initializes the map for across rows approach, only does from startingHeight to endingHeight
-std::vector<std::vector<Node> > initializeMapVert(int grid[5058][5058], int image_height, int image_width, int startingHeight, int endingHeight) {
-    std::vector<std::vector<Node> > routeMap(image_height, std::vector<Node>(image_width));
-    for (int i = startingHeight; i < endingHeight; i++) {
-        for (int j = 0; j < image_width; j++) {
-            routeMap[i][j].cost = -1;
-            routeMap[i][j].heuristic = -1;
-            routeMap[i][j].parent = NULL;
-            if (grid[i][j] == 0) {
-                routeMap[i][j].blocked = false;
-                routeMap[i][j].shadowed = false;
-            } else {
-                routeMap[i][j].blocked = true;
-                routeMap[i][j].shadowed = true;
+//getAStarPath over a skeleton of the grid, each leg is expanded back into cells. Legs to a cell in shadow are searched on the grid
+std::vector<std::pair<int, int> > getSkeletonPath(const PaddedGrid& grid, SkeletonRouter& skeleton, SearchState<int>& search, bool diagonal,
+            const std::vector<std::pair<int, int> >& destinations, int numAntennas) {
+    TRACE_SCOPE("getSkeletonPath");
+    std::vector<std::pair<int, int> > path(1, destinations[0]);
+    for (int dest = 0; dest < numAntennas; dest++) {
+        int from = grid.cell(destinations[dest].first, destinations[dest].second);
+        int to = grid.cell(destinations[dest + 1].first, destinations[dest + 1].second);
+        std::vector<std::pair<int, int> > leg;
+        if (grid.step[from] != 0 && grid.step[to] != 0) {
+            leg = skeletonPath(skeleton.graph, grid, skeleton.search, from, to);
+        } else {
+            int goal = searchToPoint(grid, search, diagonal, destinations[dest].first, destinations[dest].second, destinations[dest + 1].first, destinations[dest + 1].second);
+            if (goal != -1) {
+                leg = tracePath(grid, search, goal);
             }
-            
         }
+        if (leg.empty()) {
+            return std::vector<std::pair<int, int> >();
+        }
+        path.insert(path.end(), leg.begin() + 1, leg.end()); // The leg's start is already on the path
     }
-    return routeMap;
+    return path;
 }
 
+//Does A* algorithm, but to get to the corresponding y_goal, doesn't care about x_goal. Returns the cost and the row reached
+std::pair<int, int> getAStarPathToNearestEdge(const PaddedGrid& grid, SearchState<int>& search, bool diagonal, int start_x, int start_y, int goal_y) {
+    TRACE_SCOPE("getAStarPathToNearestEdge");
+    int goal = searchToColumn(grid, search, diagonal, start_x, start_y, goal_y);
+    if (goal == -1) {
+        return make_pair(-1, -1);
+    }
+    return make_pair(search.cost[goal], grid.row(goal));
+}
 
-//Generates a path from the destination to the start that was laid out by the A* algorithm
-std::stack<Node> makePath(std::vector<std::vector<Node> > routeMap, Node dest) {
-    std::stack<Node> path;
-    int row = dest.x;
-    int col = dest.y;
-    int i = 0;
-    while (!((*routeMap[row][col].parent).x == row && (*routeMap[row][col].parent).y == col)) { //The source parent points to itself
-        int temp_row = (*routeMap[row][col].parent).x;
-        int temp_col = (*routeMap[row][col].parent).y;
-        path.push(routeMap[row][col]);
-        row = temp_row;
-        col = temp_col;
-        
+//Finds the cheapest cell to reach of a distance field's seeds, the field already holds the cost so with it as the
+//heuristic only the cells on the path are expanded. Returns the cost and the row reached like getAStarPathToNearestEdge
+std::pair<int, int> getAStarPathToField(const PaddedGrid& grid, SearchState<int>& search, bool diagonal, const std::vector<int>& field, int start_x, int start_y) {
+    TRACE_SCOPE("getAStarPathToField");
+    int goal = searchToField(grid, search, diagonal, field, start_x, start_y);
+    if (goal == -1) {
+        return make_pair(-1, -1);
     }
-    return path;
+    return make_pair(field[grid.cell(start_x, start_y)], grid.row(goal));
 }
 
-//Returns the path laid out by A* algorithm hitting each of the destinations in the form of a stack of vertices. 
-std::stack<Node> getAStarPath(std::vector<std::vector<Node> > routeMap, std::vector<std::pair<int, int> > destinations, int numAntennas, int image_width, int image_height, int startingHeight, int endingHeight) {
-    std::stack<Node> path;
-    std::vector<std::vector<bool> > possiblePath(image_height, std::vector<bool>(image_width));
-    int start_x = destinations[0].first;
-    int start_y = destinations[0].second;
-    Node start = routeMap[start_x][start_y];
-    start.x = start_x;
-    start.y = start.y;
-    routeMap[start_x][start_y] = start;
-    routeMap[start_x][start_y].parent = &(routeMap[start_x][start_y]);
-    path.push(start);
-    
-    for (int dest = 0; dest < numAntennas; dest++) {
-        start_x = destinations[dest].first;
-        start_y = destinations[dest].second;
-        
-        start = routeMap[start_x][start_y];
-        start.x = start_x;
-        start.y = start.y;
-        routeMap[start_x][start_y] = start;
-        routeMap[start_x][start_y].parent = &(routeMap[start_x][start_y]);
-        std::priority_queue<Node, std::vector<Node>, std::greater<Node> > frontier;
-        frontier.push(routeMap[start_x][start_y]);
-        int goal_x = destinations[dest+1].first;
-        int goal_y = destinations[dest+1].second;
-        bool keepGoing = true;
-        while (!frontier.empty() && keepGoing) {
-            Node current = frontier.top();
-            frontier.pop();
-            
-            // Check for goal
-            int x = current.x;
-            int y = current.y;
-
-            int newHeur, newCost;
-            // Expand to neighbors
-            for (int dx = -1; dx < 2; dx++) { //Rows
-                for (int dy = -1; dy < 2; dy++) { //Cols can only move forward
-                    if ((dx == 0 || dy == 0) && keepGoing) { //Don't allow diagonals now
-                        if (validDirection(x, y, dx, dy, image_width, image_height, startingHeight, endingHeight)) {
-                            // printf("112 \n");
-                            if (x + dx == goal_x && y + dy == goal_y) { //Found goal
-                                Node n = routeMap[x+dx][y+dy];
-                                n.cost = newCost;
-                                n.heuristic = newHeur;
-                                n.x = x + dx;
-                                n.y = y + dy;
-                                routeMap[x + dx][y + dy] = n;
-                                routeMap[x + dx][y + dy].parent = &(routeMap[x][y]);
-                                std::stack<Node> tempPath = makePath(routeMap, routeMap[x + dx][y + dy]);
-                                while (!tempPath.empty()) {
-                                    Node n = tempPath.top();
-                                    tempPath.pop();
-                                    path.push(n);
-                                }
-                                keepGoing = false;
-                            }
-                            else if ((!possiblePath[x+dx][y+dy]) && notBlocked(routeMap, x+dx, y+dy)) {
-                                newCost = routeMap[x][y].cost + 1;
-                                newHeur = calcHeur(x + dx, y + dy, goal_x, goal_y);
-                                if (routeMap[x + dx][y + dy].cost == -1 || routeMap[x + dx][y + dy].cost + routeMap[x + dx][y + dy].heuristic > newCost + newHeur) {
-                                    Node n = routeMap[x+dx][y+dy];
-                                    n.cost = newCost;
-                                    n.heuristic = newHeur;
-                                    n.x = x + dx;
-                                    n.y = y + dy;
-                                    n.parent = &(routeMap[x][y]);
-                                    routeMap[x + dx][y + dy] = n;
-                                    frontier.push(n);
-                                }
-                            }
-                        }
-                    }
+//Refines one leg of a route from coarse to fine. The leg is searched in the window under the corridor of width
+//corridorRadius (in coarse cells) around its coarse path, widened when the leg can't be found. from is the fine cell the
+//leg starts on, (-1, -1) to snap the first coarse cell. A leg to the east edge ends on fine's last column. Returns the
+//fine leg, empty if it isn't found before the corridor covers the whole level or its window goes over budget
+std::vector<std::pair<int, int> > refineLeg(const LitLevel& coarse, const LitLevel& fine, const std::vector<std::pair<int, int> >& coarseLeg,
+            std::pair<int, int> from, bool toEast, int corridorRadius, bool diagonal, TiledMap* tiles, SearchState<int>& search) {
+    int ratio = coarse.factor / fine.factor;
+    for (int radius = corridorRadius; ; radius *= 2) {
+        bool widest = radius >= std::max(coarse.height, coarse.width);
+        TiledWindow window; // The part of fine that is searched, read from tiles if fine isn't in memory
+        if (fine.anyLit.empty() ? tiles == NULL || !readTiledWindow(*tiles, coarse, coarseLeg, radius, window) : !cutWindow(fine, coarse, coarseLeg, radius, window)) {
+            return std::vector<std::pair<int, int> >();
+        }
+        const LitLevel& searched = window.level;
+        std::pair<int, int> start(-1, -1);
+        if (from.first == -1) { // Windows start on a coarse cell, so coarse cells just shift
+            start = snapToLit(searched, window.corridor, ratio, coarseLeg.front().first - window.row0 / ratio, coarseLeg.front().second - window.col0 / ratio, ratio * (radius + 1));
+        } else if (from.first >= window.row0 && from.first < window.row0 + searched.height && from.second >= window.col0 && from.second < window.col0 + searched.width) {
+            size_t idx = (size_t)(from.first - window.row0) * searched.width + from.second - window.col0;
+            if (window.corridor[idx] && searched.anyLit[idx]) { // The previous leg may have snapped outside this corridor
+                start = std::make_pair(from.first - window.row0, from.second - window.col0);
+            }
+        }
+        std::pair<int, int> goal = snapToLit(searched, window.corridor, ratio, coarseLeg.back().first - window.row0 / ratio, coarseLeg.back().second - window.col0 / ratio, ratio * (radius + 1));
+        if (toEast) {
+            goal.second = fine.width - 1 - window.col0;
+        }
+        if (start.first != -1 && goal.first != -1) {
+            PaddedGrid grid = buildPaddedGrid(searched, &window.corridor, 0, searched.height);
+            int end = searchToPoint(grid, search, diagonal, start.first, start.second, goal.first, goal.second);
+            if (end != -1) {
+                std::vector<std::pair<int, int> > leg = tracePath(grid, search, end);
+                for (size_t p = 0; p < leg.size(); p++) {
+                    leg[p].first += window.row0;
+                    leg[p].second += window.col0;
                 }
+                return leg;
+            }
+        }
+        if (widest) {
+            return std::vector<std::pair<int, int> >();
+        }
+    }
+}
+
+//Refines a route found on levels[0] down to the full resolution level, one leg between waypoints at a time so
+//only the window under that leg's corridor is held (see refineLeg). A level with no cells in memory is read from
+//tiles. Returns the full resolution path from start to destination
+std::vector<std::pair<int, int> > refinePath(const std::vector<LitLevel>& levels, const std::vector<std::pair<int, int> >& coarsePath, 
+            const std::vector<std::pair<int, int> >& coarseWaypoints, int corridorRadius, bool diagonal, TiledMap* tiles) {
+    TRACE_SCOPE("refinePath");
+    std::vector<std::pair<int, int> > path = coarsePath;
+    std::vector<std::pair<int, int> > waypoints = coarseWaypoints;
+    for (size_t l = 1; l < levels.size(); l++) {
+        const LitLevel& coarse = levels[l - 1];
+        const LitLevel& fine = levels[l];
+        SearchState<int> search;
+        std::vector<std::pair<int, int> > finePath;
+        std::vector<std::pair<int, int> > fineWaypoints;
+        size_t begin = 0; // Where the leg starts on path
+        for (size_t w = 0; w + 1 < waypoints.size(); w++) {
+            size_t end = begin;
+            while (end < path.size() && path[end] != waypoints[w + 1]) {
+                end++;
+            }
+            if (end == path.size()) {
+                return std::vector<std::pair<int, int> >();
+            }
+            std::vector<std::pair<int, int> > coarseLeg(path.begin() + begin, path.begin() + end + 1);
+            std::pair<int, int> from = finePath.empty() ? std::make_pair(-1, -1) : finePath.back();
+            std::vector<std::pair<int, int> > leg = refineLeg(coarse, fine, coarseLeg, from, w + 2 == waypoints.size(), corridorRadius, diagonal, tiles, search);
+            if (leg.empty()) {
+                return leg;
             }
+            if (finePath.empty()) {
+                finePath.push_back(leg.front());
+                fineWaypoints.push_back(leg.front());
+            }
+            finePath.insert(finePath.end(), leg.begin() + 1, leg.end()); // The leg's start is already on the path
+            fineWaypoints.push_back(leg.back());
+            begin = end;
         }
+        path = finePath;
+        waypoints = fineWaypoints;
     }
     return path;
 }
 
+//Gives the cells seen by the viewsheds of every rank the line of sight bonus. The coverage is merged across ranks
+//before the cost model is rebuilt, so every rank prices its legs the same way and the route costs they compare at
+//the end agree. Collective over MPI_COMM_WORLD
+void applyCoverageCost(std::vector<LitLevel>& levels, const Raster<short>& dem, const std::vector<Viewshed>& sheds, NodeTerrain& terrain) {
+    std::vector<unsigned char> covered = coverageRaster(levels.back(), sheds);
+    for (size_t first = 0; first < covered.size(); first += INT_MAX) { // Counts are ints
+        int count = (int)std::min(covered.size() - first, (size_t)INT_MAX);
+        STAT_MPI(MPI_CALL_ALLREDUCE, MPI_Allreduce(MPI_IN_PLACE, &covered[first], count, MPI_UNSIGNED_CHAR, MPI_BOR, MPI_COMM_WORLD));
+    }
+    terrain.rebuildCosts(levels, [&]() { applyCostModel(levels, dem, covered, defaultCostParams()); });
+}
 
+//Ranks the antenna candidates by how much lit terrain they can see, dropping the worst. With the cost model on,
+//the cells the kept candidates of any rank can see get the line of sight bonus (see applyCoverageCost)
+void applyCoverage(std::vector<std::vector<std::pair<int,int> > >& antennaList, std::vector<int>& counts, std::vector<LitLevel>& levels, 
+            const Raster<short>& dem, bool weighted, const CoverageParams& params, NodeTerrain& terrain) {
+    TRACE_SCOPE("applyCoverage");
+    std::vector<Viewshed> sheds = rankAntennasByCoverage(antennaList, counts, levels[0], levels.back(), dem.empty() ? NULL : &dem[0], params);
+    if (weighted) {
+        applyCoverageCost(levels, dem, sheds, terrain);
+    }
+}
 
+//applyCoverage for candidates loaded from the result cache, they are already ranked so only the line of sight
+//bonus has to be redone
+void applyCachedCoverage(const std::vector<std::vector<std::pair<int,int> > >& antennaList, const std::vector<int>& counts, std::vector<LitLevel>& levels, 
+            const Raster<short>& dem, bool weighted, const CoverageParams& params, NodeTerrain& terrain) {
+    TRACE_SCOPE("applyCachedCoverage");
+    if (weighted) {
+        std::vector<Viewshed> sheds = computeViewsheds(dem.empty() ? NULL : &dem[0], levels.back(), coverageSites(antennaList, counts, levels[0], levels.back()), params);
+        applyCoverageCost(levels, dem, sheds, terrain);
+    }
+}
 
-//Does A* algorithm, but to get to the corresponding y_goal, doesn't care about x_goal. 
-std::pair<int, int> getAStarPathToNearestEdge(std::vector<std::vector<Node> > routeMap, int image_width, int image_height, int startingHeight, int endingHeight, int start_x, int start_y, int goal_y) {
+//Writes the rank's results back to the cache file (if there is one) when the run searched anything new
+void saveResultCache(const ResultCache& cache, const std::string& cacheFile, unsigned long long cacheKey, const std::vector<std::vector<std::pair<int,int> > >& antennaList,
+            const std::vector<int>& counts, const std::vector<int>& labels, int world_rank) {
+    if (cacheFile.empty()) {
+        return;
+    }
+    if (cache.loaded() && cache.newLegs() == 0) {
+        printf("Rank %d reused every leg from %s \n", world_rank, cacheFile.c_str());
+    } else if (cache.save(cacheFile, cacheKey, antennaList, counts, labels)) {
+        printf("Rank %d cached %zu new legs in %s \n", world_rank, cache.newLegs(), cacheFile.c_str());
+    } else {
+        printf("Could not write the cache %s \n", cacheFile.c_str());
+    }
+}
 
-    std::priority_queue<Node, std::vector<Node>, std::greater<Node> > frontier;
-    std::vector<std::vector<bool> > possiblePath(image_height, std::vector<bool>(image_width));
-    Node startNode = routeMap[start_x][start_y];
-    startNode.x = start_x;
-    startNode.y = start_y;
-    startNode.parent = &startNode;
-    routeMap[start_x][start_y] = startNode;
-    routeMap[start_x][start_y].parent = &(routeMap[start_x][start_y]);
-    frontier.push(startNode);
+//Starts this rank's checkpoints under prefix. Returns the first start candidate still to search, if an earlier run
+//left a checkpoint for this key the ones before it are filled in from there
+int beginCheckpoint(const char* prefix, unsigned long long key, int numStarts, int world_rank, double seconds, CheckpointState& checkpoint,
+            CheckpointWriter& writer) {
+    std::string path = std::string(prefix) + std::to_string(world_rank) + ".ckpt";
+    if (loadCheckpoint(path, key, numStarts, checkpoint)) {
+        printf("Rank %d resuming from %s at start %d of %d \n", world_rank, path.c_str(), checkpoint.nextStart, numStarts);
+    } else {
+        checkpoint.begin(key, numStarts);
+    }
+    writer.start(path, seconds);
+    return checkpoint.nextStart;
+}
 
-    while (!frontier.empty()) {
-        Node current = frontier.top();
-        frontier.pop();
-    
-        int x = current.x;
-        int y = current.y;
-
-        int newHeur, newCost;
-        // Expand to neighbors
-        for (int dx = -1; dx < 2; dx++) { //Rows
-            for (int dy = -1; dy < 2; dy++) { //Cols
-                if (dx == 0 || dy == 0) { //Don't allow diagonals now
-                    if (validDirection(x, y, dx, dy, image_width, image_height, startingHeight, endingHeight)) {
-                        // printf("112 \n");
-                        if (y + dy == goal_y) { //Found goal
-                            Node n = routeMap[x+dx][y+dy];
-                            n.cost = newCost;
-                            n.heuristic = newHeur;
-                            n.x = x + dx;
-                            n.y = y + dy;
-                            routeMap[x + dx][y + dy] = n;
-                            routeMap[x + dx][y + dy].parent = &(routeMap[x][y]);
-                            return make_pair(countPath(routeMap, routeMap[x + dx][y + dy], start_x, start_y), x+dx);
-                        }
-                        else if ((!possiblePath[x+dx][y+dy]) && notBlocked(routeMap, x+dx, y+dy)) {
-                            newCost = routeMap[x][y].cost + 1;
-                            newHeur = calcHeur(x + dx, y + dy, x+dx, goal_y);
-                            if (routeMap[x + dx][y + dy].cost == -1 || routeMap[x + dx][y + dy].cost + routeMap[x + dx][y + dy].heuristic > newCost + newHeur) {
-                                Node n = routeMap[x+dx][y+dy];
-                                n.cost = newCost;
-                                n.heuristic = newHeur;
-                                n.x = x + dx;
-                                n.y = y + dy;
-                                n.parent = &(routeMap[x][y]);
-                                routeMap[x + dx][y + dy] = n;
-                                frontier.push(n);
-                                possiblePath[x+dx][y+dy] = true;
-                            }
-                        }
-                    }
-                }
-            }
-        }
+//Key of a rank's cached results, a hash of everything its candidates, labels and leg costs depend on: the coarse
+//level (and the full one and the elevation when coverage looks at them) plus the layout in params
+unsigned long long resultCacheKey(const std::vector<LitLevel>& levels, const Raster<short>& dem, bool useCoverage, const CoverageParams& coverage,
+            const std::vector<int>& params) {
+    unsigned long long key = hashVector(params, CACHE_HASH_SEED);
+    key = hashVector(levels[0].anyLit, key);
+    key = hashVector(levels[0].allLit, key);
+    key = hashVector(levels[0].cost, key);
+    if (useCoverage) {
+        float c[5] = { coverage.radiusMeters, coverage.antennaHeight, coverage.metersPerCell, (float)coverage.maxPerGroup, coverage.minLitFraction };
+        key = hashBytes(c, sizeof(c), key);
+        key = hashVector(levels.back().anyLit, key);
+        key = hashVector(dem, key);
     }
-    return make_pair(-1, -1);
+    return key;
 }
 
 int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
+    int threadLevel; // The batch query workers draw their own chunks, one thread at a time
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &threadLevel);
     int world_size;
     int world_rank;
 
     int starting_x = 0;
 
-    const int image_height = 5058/16;
-    const int image_width = 5058/16;
+    const int corridorRadius = 2; // In cells of the coarser level
 
     const int numAntennas = 3;
 
     bool doVert = true; // Change to false to get horizontal parallelization
+    bool refine = true; // Pass c to only search the coarse level
+    bool diagonal = false; // Pass d to route with 8-connectivity
+    bool useField = false; // Pass f to price the legs that end on an edge with one reverse distance field
+    bool weighted = false; // Pass w (or --dem <file>) to use the terrain cost model instead of unit steps
+    const char* demPath = NULL;
+    bool useCoverage = false; // Pass v to rank antenna candidates by their viewshed
+    bool useSkeleton = false; // Pass g to price the antenna legs on the corridor skeleton of the grid
+    CoverageParams coverageParams = defaultCoverageParams();
+    const char* mapPath = NULL; // --map <file> replaces the compiled in map
+    const char* statsPath = NULL; // --stats <file> writes the counters as JSON (needs make STATS=1)
+    const char* routeFile = NULL; // --route <file> writes the winning route for graphit.py
+    const char* tracePrefix = NULL; // --trace <prefix> writes a timeline per rank (needs make STATS=1)
+    const char* cacheDir = NULL; // --cache <dir> reuses the candidates and leg costs of earlier runs on the same map
+    const char* queriesPath = NULL; // --queries <file> answers a batch of (start, goal) queries instead of routing
+    const char* resultsPrefix = NULL; // --results <prefix> writes the answers of each rank to <prefix><rank>.txt
+    const char* checkpointPrefix = NULL; // --checkpoint <prefix> saves finished start candidates to <prefix><rank>.ckpt and resumes from them
+    double checkpointSeconds = 60; // --checkpoint-every <seconds>
+    const char* tilesPath = NULL; // --tiles <file> keeps the full resolution level on disk as tiles, written from the map if it isn't there yet
+    double tileCacheMB = 64; // --tile-cache <MB>
     
     // Get type of mode (Mostly ignored for now)
     if (argc >= 2) {
         for (int i = 0; i < argc; i++) {
             if (strcmp(argv[i],"b") == 0) { 
                 doVert = false;
+            } else if (strcmp(argv[i],"c") == 0) {
+                refine = false;
+            } else if (strcmp(argv[i],"d") == 0) {
+                diagonal = true;
+            } else if (strcmp(argv[i],"f") == 0) {
+                useField = true;
+            } else if (strcmp(argv[i],"w") == 0) {
+                weighted = true;
+            } else if (strcmp(argv[i],"--dem") == 0 && i + 1 < argc) {
+                demPath = argv[++i];
+                weighted = true;
+            } else if (strcmp(argv[i],"v") == 0) {
+                useCoverage = true;
+            } else if (strcmp(argv[i],"g") == 0) {
+                useSkeleton = true;
+            } else if (strcmp(argv[i],"--threads") == 0 && i + 1 < argc) {
+                coverageParams.numThreads = atoi(argv[++i]);
+            } else if (strcmp(argv[i],"--map") == 0 && i + 1 < argc) {
+                mapPath = argv[++i];
+            } else if (strcmp(argv[i],"--stats") == 0 && i + 1 < argc) {
+                statsPath = argv[++i];
+            } else if (strcmp(argv[i],"--route") == 0 && i + 1 < argc) {
+                routeFile = argv[++i];
+            } else if (strcmp(argv[i],"--trace") == 0 && i + 1 < argc) {
+                tracePrefix = argv[++i];
+            } else if (strcmp(argv[i],"--cache") == 0 && i + 1 < argc) {
+                cacheDir = argv[++i];
+            } else if (strcmp(argv[i],"--queries") == 0 && i + 1 < argc) {
+                queriesPath = argv[++i];
+            } else if (strcmp(argv[i],"--results") == 0 && i + 1 < argc) {
+                resultsPrefix = argv[++i];
+            } else if (strcmp(argv[i],"--checkpoint") == 0 && i + 1 < argc) {
+                checkpointPrefix = argv[++i];
+            } else if (strcmp(argv[i],"--checkpoint-every") == 0 && i + 1 < argc) {
+                checkpointSeconds = atof(argv[++i]);
+            } else if (strcmp(argv[i],"--tiles") == 0 && i + 1 < argc) {
+                tilesPath = argv[++i];
+            } else if (strcmp(argv[i],"--tile-cache") == 0 && i + 1 < argc) {
+                tileCacheMB = atof(argv[++i]);
             }
         }
     }
+    statsStart(tracePrefix != NULL);
 
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
     MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    if (world_rank == 0 && !STATS_COMPILED_IN && (statsPath != NULL || tracePrefix != NULL)) {
+        printf("--stats and --trace need a build with make STATS=1, the counters are compiled out \n");
+    }
+
+    // With --tiles the full resolution level is only ever read a tile at a time. Rank 0 writes the tiles first if
+    // there aren't any yet
+    TiledMap tiles;
+    if (tilesPath != NULL) {
+        if (weighted || useCoverage) {
+            if (world_rank == 0) {
+                printf("Ignoring w, v and --dem with --tiles, they need the full resolution level in memory \n");
+            }
+            weighted = false;
+            useCoverage = false;
+            demPath = NULL;
+        }
+        int ready = 1;
+        if (world_rank == 0 && !tiles.open(tilesPath, (size_t)(tileCacheMB * 1048576))) {
+            ready = mapPath != NULL ? convertMapToTiles(mapPath, tilesPath, DEFAULT_TILE_SIZE) : writeTiledMap(tilesPath, &grid[0][0], 5058, 5058, 5058, DEFAULT_TILE_SIZE);
+            printf(ready ? "Wrote the tiles %s \n" : "Could not write the tiles %s \n", tilesPath);
+        }
+        STAT_MPI(MPI_CALL_BCAST, MPI_Bcast(&ready, 1, MPI_INT, 0, MPI_COMM_WORLD));
+        if (ready && !tiles.isOpen() && !tiles.open(tilesPath, (size_t)(tileCacheMB * 1048576))) {
+            printf("Could not read the tiles %s \n", tilesPath);
+            ready = 0;
+        }
+        int everyoneReady;
+        STAT_MPI(MPI_CALL_ALLREDUCE, MPI_Allreduce(&ready, &everyoneReady, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD));
+        if (!everyoneReady) {
+            MPI_Finalize();
+            return 1;
+        }
+    }
+
+    // The search runs on the coarsest level of the pyramid and is then refined to full resolution. One rank per
+    // node builds the pyramid (and the cost rasters), the others view its copy
+    std::vector<LitLevel> levels;
+    Raster<short> dem;
+    NodeTerrain terrain;
+    bool built = true;
+    if (terrain.begin()) {
+        if (tiles.isOpen()) {
+            levels = buildTiledPyramid(tiles);
+            built = !levels.empty();
+            if (!built) {
+                printf("Could not read the tiles %s \n", tilesPath);
+            }
+        } else if (mapPath != NULL) {
+            LitLevel full;
+            built = loadMap(mapPath, full);
+            if (built) {
+                levels = buildLitPyramid(full);
+            } else {
+                printf("Could not read the map %s \n", mapPath);
+            }
+        } else {
+            levels = buildLitPyramid(&grid[0][0], 5058, 5058, 5058);
+        }
+        if (built && weighted) { // Precompute the cost raster of every level once
+            if (demPath != NULL) {
+                dem = loadElevation(demPath, levels.back().height, levels.back().width);
+                if (dem.empty()) {
+                    printf("Could not read a %d x %d int16 elevation raster from %s, ignoring slope \n", levels.back().height, levels.back().width, demPath);
+                }
+            }
+            applyCostModel(levels, dem, std::vector<unsigned char>(), defaultCostParams());
+        }
+    }
+    if (!terrain.agree(built)) {
+        terrain.release();
+        MPI_Finalize();
+        return 1;
+    }
+    terrain.share(levels, dem, (double)world_rank / world_size, (double)(world_rank + 1) / world_size);
+    const int image_height = levels[0].height;
+    const int image_width = levels[0].width;
+
+    if (queriesPath != NULL) { // Batch mode, every rank reads the queries and takes groups of them until none are left
+        std::vector<RouteQuery> queries;
+        if (!loadQueries(queriesPath, queries)) {
+            printf("Could not read the queries %s \n", queriesPath);
+            terrain.release();
+            MPI_Finalize();
+            return 1;
+        }
+        PaddedGrid queryGrid = buildPaddedGrid(levels[0], NULL, 0, image_height);
+        double batchStart = MPI_Wtime();
+        long long answered = runQueryBatch(queryGrid, diagonal, queries, coverageParams.numThreads, resultsPrefix, world_rank);
+        long long totalAnswered = 0;
+        STAT_MPI(MPI_CALL_REDUCE, MPI_Reduce(&answered, &totalAnswered, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD));
+        double batchSeconds = MPI_Wtime() - batchStart;
+        printf("Rank %d answered %lld queries \n", world_rank, answered);
+        if (world_rank == 0) {
+            printf("Answered %lld queries in %.0f milliseconds, %.1f queries per second \n", totalAnswered, batchSeconds * 1000, totalAnswered / std::max(batchSeconds, 1e-9));
+        }
+        statsReport(world_rank, world_size, statsPath, tracePrefix);
+        terrain.release();
+        MPI_Finalize();
+        return 0;
+    }
 
     if (world_size == 1) {
         doVert = true;
@@ -616,9 +725,9 @@ int main(int argc, char** argv) {
     std::chrono::high_resolution_clock::time_point dataSearchTime;
     std::chrono::high_resolution_clock::time_point broadcastTime;
     std::chrono::high_resolution_clock::time_point endTime;
-    std::chrono::duration<double, std::milli> spentInitializing;
-    std::chrono::duration<double, std::milli> spentFindingAntennas;
-    std::chrono::duration<double, std::milli> spendSearchingData;
+    std::chrono::duration<double, std::milli> spentInitializing(0); // Stay zero on the branches that skip a phase
+    std::chrono::duration<double, std::milli> spentFindingAntennas(0);
+    std::chrono::duration<double, std::milli> spendSearchingData(0);
     startTime = std::chrono::high_resolution_clock::now();
     
 
@@ -628,29 +737,71 @@ int main(int argc, char** argv) {
     
 
     int numAntennasPerProc = numAntennas / world_size;
-    std::unordered_map<int, Node> came_from;
-    std::unordered_map<int, float> cost_so_far;
-    std::vector<std::vector<bool> > preventedPaths(image_height, std::vector<bool>(image_width));
-    std::vector<std::vector<Node> > routeMap(image_height, std::vector<Node>(image_width)); 
+    SearchState<int> search; // Reused by every search on this rank
+    ResultCache cache; // Legs already searched, loaded from cacheDir if an earlier run left them there
+    std::string cacheFile;
+    unsigned long long cacheKey = 0;
+    if (cacheDir != NULL || checkpointPrefix != NULL) {
+        // Leads with the format, 2 since band labels index a grid of only the band's rows
+        int layout[] = { 2, doVert, world_size, world_rank, numAntennas, startingHeight, endingHeight, startingWidth, endingWidth, levels[0].factor, diagonal, weighted, useCoverage };
+        cacheKey = resultCacheKey(levels, dem, useCoverage, coverageParams, std::vector<int>(layout, layout + sizeof(layout) / sizeof(int)));
+    }
+    if (cacheDir != NULL) {
+        cacheFile = cachePath(cacheDir, cacheKey);
+        cache.load(cacheFile, cacheKey);
+    }
+    unsigned long long checkpointKey = hashBytes(&useField, sizeof(useField), cacheKey); // f changes what the final legs cost
+    CheckpointState checkpoint;
+    CheckpointWriter checkpointWriter; // Only started with --checkpoint
+    std::vector<int> labels; // Lit components of the grid the legs are searched on
     
     
     int minValuePath = INT_MAX;
-    Node minStartingPath;
-    std::stack<Node> finalPath;
+    std::vector<std::pair<int, int> > finalPath;
+    std::vector<std::pair<int, int> > finalWaypoints;
     int localMinCount = -1;
     if (doVert) { //Doing across rows
         if (world_size != 0) {
             //First initialize map and find antenna locations
-            routeMap = initializeMapVert(grid, image_height, image_width, startingHeight, endingHeight);
+            BandScan band = scanBand(levels[0], startingHeight, endingHeight, coverageParams.numThreads);
+            PaddedGrid bandGrid;
+            std::swap(bandGrid, band.grid);
             initialTime = std::chrono::high_resolution_clock::now();   
             spentInitializing = initialTime - startTime;
-            std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > antennaPair = findAntennasHeightNew(grid, routeMap, startingHeight, endingHeight, startingWidth, image_width, image_height, numAntennas);
+            std::vector<std::vector<std::pair<int,int> > > antennaList;
+            std::vector<int> counts;
+            if (cache.loaded()) {
+                cache.candidates(antennaList, counts);
+                if (useCoverage) {
+                    applyCachedCoverage(antennaList, counts, levels, dem, weighted, coverageParams, terrain);
+                }
+            } else {
+                std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > antennaPair = findAntennasHeightNew(band.candidateRows, startingHeight, endingHeight, startingWidth, image_width, image_height, numAntennas);
+                antennaList = antennaPair.first;
+                counts = antennaPair.second;
+                if (useCoverage) {
+                    applyCoverage(antennaList, counts, levels, dem, weighted, coverageParams, terrain);
+                }
+            }
+            if (useCoverage) { // The cost model changed under the scan
+                bandGrid = buildPaddedGrid(levels[0], NULL, startingHeight, endingHeight);
+            }
+            labels = cache.loaded() ? cache.labels() : labelComponents(bandGrid);
+            SkeletonRouter bandSkeleton;
+            if (useSkeleton) {
+                bandSkeleton.graph = buildSkeleton(bandGrid, diagonal);
+                reportSkeleton(bandSkeleton.graph, bandGrid, world_rank);
+                if (!skeletonPaysOff(bandSkeleton.graph, bandGrid)) { // Legs go to the grid search, see MAX_SKELETON_NODE_SHARE
+                    useSkeleton = false;
+                    bandSkeleton = SkeletonRouter();
+                }
+            }
+            std::vector<int> edgeField; // Cost from every cell of the band to the nearest lit cell on the east edge
+            if (useField) {
+                edgeField = distanceField(bandGrid, diagonal, columnCells(bandGrid, image_width - 1));
+            }
             findAntennasTime = std::chrono::high_resolution_clock::now(); 
             spentFindingAntennas = findAntennasTime - initialTime;
-            std::vector<std::vector<std::pair<int,int> > > antennaList = antennaPair.first;
-            std::vector<int> counts = antennaPair.second;
-
-            Node minNode;
 
             // Below is for printing antenna locations for images
             // for (int i = 0; i < numAntennas; i++) {
@@ -663,119 +814,170 @@ int main(int argc, char** argv) {
             int dest = 0;
             int start = 0;
             int minTotalStartingCount = INT_MAX;
-            std::vector<std::pair<int, int> > totalMinAntennas(numAntennas + 1);
-            Node minStartingNode;
+            std::vector<std::pair<int, int> > totalMinAntennas; // Start, the antennas on the route and the east edge
+
+            int firstStart = 0;
+            GlobalIncumbent incumbent;
+            if (checkpointPrefix != NULL) {
+                firstStart = beginCheckpoint(checkpointPrefix, checkpointKey, counts[0], world_rank, checkpointSeconds, checkpoint, checkpointWriter);
+                minTotalStartingCount = checkpoint.bestCost;
+                totalMinAntennas = checkpoint.bestChain;
+                incumbent.open(world_rank);
+            }
 
             //Find the antenna locations with the minimum path
-            for (int si = 0; si < counts[0]; si++) { //Vary the starting row
+            for (int si = firstStart; si < counts[0]; si++) { //Vary the starting row
                 int startX = antennaList[0][si].first;
                 int startY = antennaList[0][si].second;
-                Node startingNode = routeMap[startX][startY];
-                startingNode.x = startX;
-                startingNode.y = startY;
-                startingNode.parent = &(startingNode);
-                routeMap[startX][startY] = startingNode;
-                Node sourceNode = startingNode;
-                std::vector<std::pair<int, int> > minAntennasPerStart(numAntennas + 1);
+                std::pair<int, int> source(startX, startY);
+                std::vector<std::pair<int, int> > minAntennasPerStart(1, std::make_pair(startX, startY));
                 int countPerStartingNode = 0;
                 dest = 0;
-                Node minFinDest;
                 bool keepGoing = true;
-                while (dest < numAntennas && keepGoing) { // Greedy algo to find the minimum route for a given starting node
+                while (dest + 1 < numAntennas && keepGoing) { // Greedy algo to find the minimum route for a given starting node
                     dest++;
+                    if (counts[dest] == 0) { // No candidates in this antenna's columns, the route skips it
+                        continue;
+                    }
                     int min = INT_MAX;
-                    Node minDest;
+                    std::pair<int, int> minDest;
                     for (int i = 0; i < counts[dest]; i++) { // Check each potential antenna placement at a given site
-                        std::priority_queue<Node, std::vector<Node>, std::greater<Node> > frontier;
-                        frontier.push(sourceNode);
                         int dest_x = antennaList[dest][i].first;
                         int dest_y = antennaList[dest][i].second;
-                        std::pair<int, std::vector<std::vector<Node> > > AStarRes = doAStar(frontier, routeMap, preventedPaths, came_from, cost_so_far, image_width, image_height, startingHeight, endingHeight, sourceNode.x, sourceNode.y, dest_x, dest_y);
-                        int c = AStarRes.first;
-                        routeMap = AStarRes.second;
+                        int c = cachedAStar(cache, labels, useSkeleton ? &bandSkeleton : NULL, bandGrid, search, diagonal, source.first, source.second, dest_x, dest_y);
                         if (c > 0 && (c < min)) { // Check if min across different destinations
-                            minDest = routeMap[dest_x][dest_y];
+                            minDest = std::make_pair(dest_x, dest_y);
                             min = c;
-                            minAntennasPerStart[dest] = std::make_pair(dest_x, dest_y);
-                            if (dest == numAntennas - 1) {
-                                routeMap[dest_x][dest_y].parent = &(routeMap[dest_x][dest_y]);
-                                minFinDest = routeMap[dest_x][dest_y];
-                            }
                         }
                     }
                     if (min != INT_MAX) { // Get min 
                         countPerStartingNode += min;
-                        sourceNode = minDest;
+                        source = minDest;
+                        minAntennasPerStart.push_back(minDest);
                     } else {
                         keepGoing = false;
                     }
+                    if (countPerStartingNode > checkpoint.globalBest) { // Some rank already has a cheaper route, this start can't win
+                        keepGoing = false;
+                    }
                     
                 }
 
-                if (countPerStartingNode > 0) { // Get distance from last node to the final one.
-                    std::priority_queue<Node, std::vector<Node>, std::greater<Node> > frontier;
-                    frontier.push(minFinDest);
-                    std::pair<int, std::vector<std::vector<Node> > > AStarRes = doAStar(frontier, routeMap, preventedPaths, came_from, cost_so_far, image_width, image_height, startingHeight, endingHeight, minFinDest.x, minFinDest.y, startingNode.x, image_width - 1 );
-                    int final_count = AStarRes.first;
-                    routeMap = AStarRes.second;
+                int chainCost = -1;
+                if (countPerStartingNode > 0 && keepGoing) { // Get distance from the last antenna to the east edge
+                    int final_count;
+                    if (useField) { // Any lit cell on the east edge will do
+                        final_count = edgeField[bandGrid.cell(source.first, source.second)];
+                    } else {
+                        final_count = cachedAStar(cache, labels, useSkeleton ? &bandSkeleton : NULL, bandGrid, search, diagonal, source.first, source.second, startX, image_width - 1);
+                    }
                     if (final_count > 0) {
-                        if (countPerStartingNode > 0 && (countPerStartingNode < minTotalStartingCount)) {
+                        countPerStartingNode += final_count;
+                        chainCost = countPerStartingNode;
+                        if (countPerStartingNode < minTotalStartingCount) {
                             totalMinAntennas = minAntennasPerStart;
-                            totalMinAntennas[0] = make_pair(startingNode.x, startingNode.y);
-                            countPerStartingNode = final_count;
+                            totalMinAntennas.push_back(make_pair(startX, image_width - 1));
                             minTotalStartingCount = countPerStartingNode;
-                            minStartingNode = startingNode;
                         }
                     }
                 }
+
+                if (checkpointWriter.started()) {
+                    checkpoint.costs[si] = chainCost;
+                    checkpoint.nextStart = si + 1;
+                    if (checkpointWriter.due() || si + 1 == counts[0]) {
+                        checkpoint.bestCost = minTotalStartingCount;
+                        checkpoint.bestChain = totalMinAntennas;
+                        checkpoint.globalBest = incumbent.report(minTotalStartingCount);
+                        checkpointWriter.post(checkpoint);
+                    }
+                }
+            }
+            if (checkpointWriter.started()) {
+                printf("Rank %d wrote %d checkpoints \n", world_rank, checkpointWriter.finish());
+                incumbent.close();
             }
 
 
 
             dataSearchTime = std::chrono::high_resolution_clock::now(); 
             spendSearchingData = dataSearchTime - findAntennasTime;
+            saveResultCache(cache, cacheFile, cacheKey, antennaList, counts, labels, world_rank);
 
             // Now get the path 
             minValuePath = minTotalStartingCount;
-            minStartingPath = minStartingNode;
             if (minValuePath == -1) {
                 minValuePath = INT_MAX;
             }
 
-
-            
-
-            totalMinAntennas[numAntennas] = make_pair(totalMinAntennas[0].first, image_width - 1);
-
-            
-            routeMap = initializeMapVert(grid, image_height, image_width, startingHeight, endingHeight);
-            std::stack<Node> path = getAStarPath(routeMap, totalMinAntennas, numAntennas, image_width, image_height, 0, image_height);
-            
-            
-            // Now orient path in correct order and print if you so desire
-            while (!path.empty()) {
-                Node n = path.top();
-                path.pop();
-                finalPath.push(n);
-                localMinCount++;
+            if (!totalMinAntennas.empty()) {
+                if (useField) { // Find which east edge cell the last antenna is closest to
+                    std::pair<int, int> last = totalMinAntennas[totalMinAntennas.size() - 2];
+                    int edge = searchToField(bandGrid, search, diagonal, edgeField, last.first, last.second);
+                    totalMinAntennas.back() = make_pair(bandGrid.row(edge), bandGrid.col(edge));
+                }
+                finalWaypoints = totalMinAntennas;
+                if (useSkeleton) { // Every leg was priced inside the band, so it is expanded there too
+                    finalPath = getSkeletonPath(bandGrid, bandSkeleton, search, diagonal, totalMinAntennas, (int)totalMinAntennas.size() - 1);
+                } else {
+                    finalPath = getAStarPath(bandGrid, search, diagonal, totalMinAntennas, (int)totalMinAntennas.size() - 1);
+                }
             }
+            localMinCount = finalPath.empty() ? INT_MAX : routeCost(levels[0], finalPath);
 
 
         }
     }
     else { // Do parallelization across width
-        routeMap = initializeMapVert(grid, image_height, image_width, 0, image_height);
-        std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > antennaPair = findAntennasHeightAcrossWidth(grid, routeMap, startingWidth, endingWidth, image_width, image_height, numAntennasPerProc);
-        std::vector<std::vector<std::pair<int,int> > > antennaList = antennaPair.first;
-        std::vector<int> counts = antennaPair.second;
+        BandScan band = scanBand(levels[0], 0, image_height, coverageParams.numThreads);
+        PaddedGrid fullGrid;
+        std::swap(fullGrid, band.grid);
+        initialTime = std::chrono::high_resolution_clock::now();
+        spentInitializing = initialTime - startTime;
+        std::vector<std::vector<std::pair<int,int> > > antennaList;
+        std::vector<int> counts;
+        if (cache.loaded()) {
+            cache.candidates(antennaList, counts);
+            if (useCoverage) {
+                applyCachedCoverage(antennaList, counts, levels, dem, weighted, coverageParams, terrain);
+            }
+        } else {
+            std::pair<std::vector<std::vector<std::pair<int,int> > >, std::vector<int> > antennaPair = findAntennasHeightAcrossWidth(band.candidateRows, startingWidth, endingWidth, image_width, image_height, numAntennasPerProc);
+            antennaList = antennaPair.first;
+            counts = antennaPair.second;
+            if (useCoverage) {
+                applyCoverage(antennaList, counts, levels, dem, weighted, coverageParams, terrain);
+            }
+        }
+        if (useCoverage) { // The cost model changed under the scan
+            fullGrid = buildPaddedGrid(levels[0], NULL, 0, image_height);
+        }
+        labels = cache.loaded() ? cache.labels() : labelComponents(fullGrid);
+        SkeletonRouter fullSkeleton;
+        if (useSkeleton) {
+            fullSkeleton.graph = buildSkeleton(fullGrid, diagonal);
+            reportSkeleton(fullSkeleton.graph, fullGrid, world_rank);
+            if (!skeletonPaysOff(fullSkeleton.graph, fullGrid)) { // Legs go to the grid search, see MAX_SKELETON_NODE_SHARE
+                useSkeleton = false;
+                fullSkeleton = SkeletonRouter();
+            }
+        }
+        std::vector<int> boundaryField; // Cost from every cell to the nearest lit cell on the western boundary of the strip
+        if (useField) {
+            boundaryField = distanceField(fullGrid, diagonal, columnCells(fullGrid, world_rank != 0 ? startingWidth - 1 : 0));
+        }
+        findAntennasTime = std::chrono::high_resolution_clock::now();
+        spentFindingAntennas = findAntennasTime - initialTime;
         std::vector<int> sendAntennas(counts[0]);
         int sendingCount = 0;
         for (int i = 0; i < counts[0]; i++) {
             std::pair<int, int> sending;
-            if (world_rank != 0) {
-                sending = getAStarPathToNearestEdge(routeMap, image_width, image_height, 0, image_height, antennaList[0][i].first, antennaList[0][i].second, startingWidth-1);
+            if (useField) {
+                sending = getAStarPathToField(fullGrid, search, diagonal, boundaryField, antennaList[0][i].first, antennaList[0][i].second);
+            } else if (world_rank != 0) {
+                sending = getAStarPathToNearestEdge(fullGrid, search, diagonal, antennaList[0][i].first, antennaList[0][i].second, startingWidth-1);
             } else {
-                sending = getAStarPathToNearestEdge(routeMap, image_width, image_height, 0, image_height, antennaList[0][i].first, antennaList[0][i].second, 0);
+                sending = getAStarPathToNearestEdge(fullGrid, search, diagonal, antennaList[0][i].first, antennaList[0][i].second, 0);
             }
             if (sending.first != -1) {
                 sendAntennas[sendingCount] = sending.second;
@@ -791,39 +993,47 @@ int main(int argc, char** argv) {
         MPI_Status status;
         
         if (world_rank == 0) { //Process 0 sends to last first
-            MPI_Send(&sendingCount, 1, MPI_INT, world_size - 1, 0, MPI_COMM_WORLD);
-            MPI_Send(&sendAntennas[0], sendingCount, MPI_INT, world_size-1, 0, MPI_COMM_WORLD);
+            STAT_MPI(MPI_CALL_SEND, MPI_Send(&sendingCount, 1, MPI_INT, world_size - 1, 0, MPI_COMM_WORLD));
+            STAT_MPI(MPI_CALL_SEND, MPI_Send(&sendAntennas[0], sendingCount, MPI_INT, world_size-1, 0, MPI_COMM_WORLD));
             // printf("1040 %d \n", world_rank);
-            MPI_Recv(&destCount, 1, MPI_INT, 1, 0, MPI_COMM_WORLD, &status);
+            STAT_MPI(MPI_CALL_RECV, MPI_Recv(&destCount, 1, MPI_INT, 1, 0, MPI_COMM_WORLD, &status));
             // printf("1042 %d %d\n", world_rank, destCount);
-            MPI_Recv(&destAntenna[0], destCount, MPI_INT, 1, 0, MPI_COMM_WORLD, &status);
+            STAT_MPI(MPI_CALL_RECV, MPI_Recv(&destAntenna[0], destCount, MPI_INT, 1, 0, MPI_COMM_WORLD, &status));
         } else if (world_rank == world_size - 1) { 
-            MPI_Recv(&destCount, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, &status);
-            MPI_Recv(&destAntenna[0], destCount, MPI_INT, 0, 0, MPI_COMM_WORLD, &status);
+            STAT_MPI(MPI_CALL_RECV, MPI_Recv(&destCount, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, &status));
+            STAT_MPI(MPI_CALL_RECV, MPI_Recv(&destAntenna[0], destCount, MPI_INT, 0, 0, MPI_COMM_WORLD, &status));
             // printf("1046 %d \n", world_rank);
             // printf("1048 %d %d\n", world_rank, destCount);
-            MPI_Send(&sendingCount, 1, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD);
-            MPI_Send(&sendAntennas[0], sendingCount, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD);
+            STAT_MPI(MPI_CALL_SEND, MPI_Send(&sendingCount, 1, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD));
+            STAT_MPI(MPI_CALL_SEND, MPI_Send(&sendAntennas[0], sendingCount, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD));
 
         } else if (world_rank % 2 == 0) { //Even ranks send back first
-            MPI_Send(&sendingCount, 1, MPI_INT, world_rank - 1, 0, MPI_COMM_WORLD);
-            MPI_Send(&sendAntennas[0], sendingCount, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD);
+            STAT_MPI(MPI_CALL_SEND, MPI_Send(&sendingCount, 1, MPI_INT, world_rank - 1, 0, MPI_COMM_WORLD));
+            STAT_MPI(MPI_CALL_SEND, MPI_Send(&sendAntennas[0], sendingCount, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD));
             // printf("1053 %d \n", world_rank);
-            MPI_Recv(&destCount, 1, MPI_INT, world_rank+1, 0, MPI_COMM_WORLD, &status);
+            STAT_MPI(MPI_CALL_RECV, MPI_Recv(&destCount, 1, MPI_INT, world_rank+1, 0, MPI_COMM_WORLD, &status));
             // printf("1057 %d %d\n", world_rank, destCount);
-            MPI_Recv(&destAntenna[0], destCount, MPI_INT, world_rank+1, 0, MPI_COMM_WORLD, &status);
+            STAT_MPI(MPI_CALL_RECV, MPI_Recv(&destAntenna[0], destCount, MPI_INT, world_rank+1, 0, MPI_COMM_WORLD, &status));
         } else { //odd ranks recieve first
-            MPI_Recv(&destCount, 1, MPI_INT, world_rank + 1, 0, MPI_COMM_WORLD, &status);
-            MPI_Recv(&destAntenna[0], destCount, MPI_INT, world_rank + 1, 0, MPI_COMM_WORLD, &status);
+            STAT_MPI(MPI_CALL_RECV, MPI_Recv(&destCount, 1, MPI_INT, world_rank + 1, 0, MPI_COMM_WORLD, &status));
+            STAT_MPI(MPI_CALL_RECV, MPI_Recv(&destAntenna[0], destCount, MPI_INT, world_rank + 1, 0, MPI_COMM_WORLD, &status));
             // printf("1059 %d \n", world_rank);
             // printf("1063 %d %d\n", world_rank, destCount);
-            MPI_Send(&sendingCount, 1, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD);
-            MPI_Send(&sendAntennas[0], sendingCount, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD);
+            STAT_MPI(MPI_CALL_SEND, MPI_Send(&sendingCount, 1, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD));
+            STAT_MPI(MPI_CALL_SEND, MPI_Send(&sendAntennas[0], sendingCount, MPI_INT, world_rank-1, 0, MPI_COMM_WORLD));
         }
 
         // printf("%d Rank has finished initial sends and recieves \n", world_rank);
         // Each element is the ((start_x,start_y), (end_x, end,y), cost)
         std::vector<std::pair<std::pair<std::pair<int, int>, std::pair<int,int> >, int> > minPaths(counts[0]);
+        std::vector<int> destField; // Cost from every cell to the nearest of the cells the next strip starts from
+        if (useField) {
+            std::vector<int> seeds(destCount);
+            for (int j = 0; j < destCount; j++) {
+                seeds[j] = fullGrid.cell(destAntenna[j], endingWidth - 1);
+            }
+            destField = distanceField(fullGrid, diagonal, seeds);
+        }
         for (int i =0; i < counts[0]; i++) {
             minPaths[i].second = INT_MAX;
         }
@@ -831,72 +1041,71 @@ int main(int argc, char** argv) {
         int start = 0;
         int minTotalStartingCount = INT_MAX;
         std::vector<std::pair<int, int> > totalMinAntennas(numAntennas + 1);
-        Node minStartingNode;
+        int firstStart = 0;
+        if (checkpointPrefix != NULL) {
+            firstStart = beginCheckpoint(checkpointPrefix, checkpointKey, counts[0], world_rank, checkpointSeconds, checkpoint, checkpointWriter);
+            for (int si = 0; si < firstStart; si++) {
+                if (checkpoint.costs[si] > 0) {
+                    minPaths[si].first = std::make_pair(antennaList[0][si], std::make_pair(endingWidth, checkpoint.endRows[si]));
+                    minPaths[si].second = checkpoint.costs[si];
+                }
+            }
+        }
         // Find the antenna locations with the minimum path
-        for (int si = 0; si < counts[0]; si++) { // Vary the starting row
+        for (int si = firstStart; si < counts[0]; si++) { // Vary the starting row
             int startX = antennaList[0][si].first;
             int startY = antennaList[0][si].second;
-            Node startingNode = routeMap[startX][startY];
-            startingNode.x = startX;
-            startingNode.y = startY;
-            startingNode.parent = &(startingNode);
-            routeMap[startX][startY] = startingNode;
-            Node sourceNode = startingNode;
+            std::pair<int, int> source(startX, startY);
             std::vector<std::pair<int, int> > minAntennasPerStart(numAntennas + 1);
             int countPerStartingNode = 0;
             dest = 0;
-            Node minFinDest;
             bool keepGoing = true;
-            while (dest < numAntennasPerProc && keepGoing) { // Greedy algo to find the minimum route for a given starting node
+            while (dest + 1 < numAntennasPerProc && keepGoing) { // Greedy algo to find the minimum route for a given starting node
                 dest++;
+                if (counts[dest] == 0) { // No candidates in this antenna's columns, the route skips it
+                    continue;
+                }
                 int min = INT_MAX;
-                Node minDest;
+                std::pair<int, int> minDest;
                 for (int i = 0; i < counts[dest]; i++) { // Check each potential antenna placement at a given site
-                    std::priority_queue<Node, std::vector<Node>, std::greater<Node> > frontier;
-                    frontier.push(sourceNode);
                     int dest_x = antennaList[dest][i].first;
                     int dest_y = antennaList[dest][i].second;
-                    std::pair<int, std::vector<std::vector<Node> > > AStarRes = doAStar(frontier, routeMap, preventedPaths, came_from, cost_so_far, image_width, image_height, 0, image_height, sourceNode.x, sourceNode.y, dest_x, dest_y);
-                    int c = AStarRes.first;
-                    routeMap = AStarRes.second;
+                    int c = cachedAStar(cache, labels, useSkeleton ? &fullSkeleton : NULL, fullGrid, search, diagonal, source.first, source.second, dest_x, dest_y);
 
                     if (c > 0 && (c < min)) { // Check if min across different destinations
                         // printf("%d \n", world_rank);
-                        minDest = routeMap[dest_x][dest_y];
+                        minDest = std::make_pair(dest_x, dest_y);
                         min = c;
                         minAntennasPerStart[dest] = std::make_pair(dest_x, dest_y);
-                        if (dest == numAntennas - 1) {
-                            routeMap[dest_x][dest_y].parent = &(routeMap[dest_x][dest_y]);
-                            minFinDest = routeMap[dest_x][dest_y];
-                        }
                     }
                     // printf(" %d \n", min);
                 }
                 if (min != INT_MAX) { // Get min 
                     countPerStartingNode += min;
-                    sourceNode = minDest;
+                    source = minDest;
                 } else {
                     keepGoing = false;
                 }
                 
             }
 
-            if (numAntennasPerProc < 2) {
-                minFinDest = startingNode;
-            }
+            std::pair<int, int> minFinDest = source; // The last antenna reached
 
-            if (countPerStartingNode > 0 || numAntennasPerProc < 2) { // Get distance from last node to the final one.                
+            if ((countPerStartingNode > 0 && keepGoing) || numAntennasPerProc < 2) { // Get distance from last node to the final one.                
                 int final_count = -1; 
                 int minFinDestTot = -1;
                 // printf("608 \n");
-                for (int j = 0; j < destCount; j++) {
-                    std::priority_queue<Node, std::vector<Node>, std::greater<Node> > frontier;
-                    std::vector<std::vector<bool> > preventedPaths(image_height, std::vector<bool>(image_width));
-                    frontier.push(minFinDest);
-                    std::pair<int, std::vector<std::vector<Node> > > AStarRes = doAStar(frontier, routeMap, preventedPaths, came_from, cost_so_far, image_width, image_height, 0, image_height, minFinDest.x, minFinDest.y, destAntenna[j], endingWidth - 1); //Now need to iterate to each of the 
-                    int minFinalCount = AStarRes.first;
-
-                    routeMap = AStarRes.second;
+                if (useField) {
+                    std::pair<int, int> reached = getAStarPathToField(fullGrid, search, diagonal, destField, minFinDest.first, minFinDest.second);
+                    for (int j = 0; j < destCount && minFinDestTot == -1; j++) {
+                        if (reached.first > 0 && destAntenna[j] == reached.second) {
+                            minFinDestTot = j;
+                            final_count = reached.first;
+                        }
+                    }
+                }
+                for (int j = 0; j < destCount && !useField; j++) {
+                    int minFinalCount = cachedAStar(cache, labels, useSkeleton ? &fullSkeleton : NULL, fullGrid, search, diagonal, minFinDest.first, minFinDest.second, destAntenna[j], endingWidth - 1); //Now need to iterate to each of the 
                     if (minFinalCount > 0 && (final_count == -1 || minFinalCount < final_count)) {
                         minFinDestTot = j;
                         final_count = minFinalCount;
@@ -908,9 +1117,26 @@ int main(int argc, char** argv) {
                     minPaths[si].first.second.first = endingWidth;
                     minPaths[si].first.second.second = destAntenna[minFinDestTot];
                     minPaths[si].second = final_count;
+                    if (checkpointWriter.started()) {
+                        checkpoint.costs[si] = final_count;
+                        checkpoint.endRows[si] = destAntenna[minFinDestTot];
+                    }
+                }
+            }
+            if (checkpointWriter.started()) {
+                checkpoint.nextStart = si + 1;
+                if (checkpointWriter.due() || si + 1 == counts[0]) {
+                    checkpointWriter.post(checkpoint);
                 }
             }
         }
+        if (checkpointWriter.started()) {
+            printf("Rank %d wrote %d checkpoints \n", world_rank, checkpointWriter.finish());
+        }
+
+        dataSearchTime = std::chrono::high_resolution_clock::now();
+        spendSearchingData = dataSearchTime - findAntennasTime;
+        saveResultCache(cache, cacheFile, cacheKey, antennaList, counts, labels, world_rank);
 
         // Find minimum path across antennas to destinations
         int numIters;
@@ -922,22 +1148,22 @@ int main(int argc, char** argv) {
         int minForPath = INT_MAX;
         int recY;
         
-        MPI_Barrier(MPI_COMM_WORLD);
-        MPI_Bcast(&(numIters), 1, MPI_INT, 0, MPI_COMM_WORLD); // Get number of iterations
+        STAT_MPI(MPI_CALL_BARRIER, MPI_Barrier(MPI_COMM_WORLD));
+        STAT_MPI(MPI_CALL_BCAST, MPI_Bcast(&(numIters), 1, MPI_INT, 0, MPI_COMM_WORLD)); // Get number of iterations
         for (int i = 0; i < numIters; i++) { 
             minForPath = INT_MAX;
             if (world_rank == 0) {
-                MPI_Send(&(minPaths[i].first.second.second), 1, MPI_INT, 1, 0, MPI_COMM_WORLD);
-                MPI_Send(&(minPaths[i].second), 1, MPI_INT, 1, 0, MPI_COMM_WORLD);
-                MPI_Recv(&(minForPath), 1, MPI_INT, world_size- 1, 0, MPI_COMM_WORLD, &status);
+                STAT_MPI(MPI_CALL_SEND, MPI_Send(&(minPaths[i].first.second.second), 1, MPI_INT, 1, 0, MPI_COMM_WORLD));
+                STAT_MPI(MPI_CALL_SEND, MPI_Send(&(minPaths[i].second), 1, MPI_INT, 1, 0, MPI_COMM_WORLD));
+                STAT_MPI(MPI_CALL_RECV, MPI_Recv(&(minForPath), 1, MPI_INT, world_size- 1, 0, MPI_COMM_WORLD, &status));
                 if (minForPath < minPathOverall) {
                     minStart = i;
                     minPathOverall = minForPath;
                 }
             }
             else if (world_rank == world_size - 1) {
-                MPI_Recv(&recY, 1, MPI_INT, world_rank - 1, 0, MPI_COMM_WORLD, &status);
-                MPI_Recv(&minForPath, 1, MPI_INT, world_rank - 1,0, MPI_COMM_WORLD, &status);
+                STAT_MPI(MPI_CALL_RECV, MPI_Recv(&recY, 1, MPI_INT, world_rank - 1, 0, MPI_COMM_WORLD, &status));
+                STAT_MPI(MPI_CALL_RECV, MPI_Recv(&minForPath, 1, MPI_INT, world_rank - 1,0, MPI_COMM_WORLD, &status));
                 bool possible = true;
                 for (int j = 0; j < counts[0]; j++) {
                     if (possible && minPaths[j].first.second.second == recY) {
@@ -945,10 +1171,10 @@ int main(int argc, char** argv) {
                         possible = false;
                     }
                 }
-                MPI_Send(&minForPath, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
+                STAT_MPI(MPI_CALL_SEND, MPI_Send(&minForPath, 1, MPI_INT, 0, 0, MPI_COMM_WORLD));
             } else {
-                MPI_Recv(&recY, 1, MPI_INT, world_rank - 1, 0, MPI_COMM_WORLD, &status);
-                MPI_Recv(&minForPath, 1, MPI_INT, world_rank - 1,0, MPI_COMM_WORLD, &status);
+                STAT_MPI(MPI_CALL_RECV, MPI_Recv(&recY, 1, MPI_INT, world_rank - 1, 0, MPI_COMM_WORLD, &status));
+                STAT_MPI(MPI_CALL_RECV, MPI_Recv(&minForPath, 1, MPI_INT, world_rank - 1,0, MPI_COMM_WORLD, &status));
                 bool possible = true;
                 int minDest = -1;
                 for (int j = 0; j < counts[0]; j++) {
@@ -958,16 +1184,18 @@ int main(int argc, char** argv) {
                         minDest = j;
                     }
                 }
-                MPI_Send(&minDest, 1, MPI_INT, world_rank + 1, 0, MPI_COMM_WORLD);
-                MPI_Send(&minForPath, 1, MPI_INT, world_rank + 1, 0, MPI_COMM_WORLD);
+                STAT_MPI(MPI_CALL_SEND, MPI_Send(&minDest, 1, MPI_INT, world_rank + 1, 0, MPI_COMM_WORLD));
+                STAT_MPI(MPI_CALL_SEND, MPI_Send(&minForPath, 1, MPI_INT, world_rank + 1, 0, MPI_COMM_WORLD));
             }
         }
-        if (world_rank == 0) {
+        if (world_rank == 0 && minStart != -1) {
             printf("Found minimum path starting at (%d, %d) with cost %d \n", minPaths[minStart].first.first.first, minPaths[minStart].first.first.second, minPathOverall);
+        } else if (world_rank == 0) {
+            printf("No path found \n");
         }
     }
     
-    MPI_Barrier(MPI_COMM_WORLD); // Make sure all threads are stopped
+    STAT_MPI(MPI_CALL_BARRIER, MPI_Barrier(MPI_COMM_WORLD)); // Make sure all threads are stopped
 
 
     if (doVert) {
@@ -978,17 +1206,30 @@ int main(int argc, char** argv) {
         procres[0] = localMinCount;
         procres[1] = world_rank;
         int globalres[2];
-        MPI_Allreduce(procres, globalres, 1, MPI_2INT, MPI_MINLOC, MPI_COMM_WORLD);
-        MPI_Barrier(MPI_COMM_WORLD);
+        STAT_MPI(MPI_CALL_ALLREDUCE, MPI_Allreduce(procres, globalres, 1, MPI_2INT, MPI_MINLOC, MPI_COMM_WORLD));
+        STAT_MPI(MPI_CALL_BARRIER, MPI_Barrier(MPI_COMM_WORLD));
         if (world_rank == globalres[1]) {
             printf("The total minimum path was across %d and ", world_rank);
-            // while (!finalPath.empty()) { //If need to print path (e.g. for graphit.py)
-            //     Node n = finalPath.top();
-            //     finalPath.pop();
-            //     printf("(%d, %d)-> ", n.x, n.y);
-            // }
             printf("\n with Cost: %d", localMinCount);
             printf("\n");
+            std::vector<std::pair<int, int> > routePath = finalPath; // What --route writes, the coarse route unless it gets refined
+            int routeFactor = levels[0].factor;
+            if (refine && localMinCount != INT_MAX) { // Only the winning rank refines its route
+                std::vector<std::pair<int, int> > fullPath = refinePath(levels, finalPath, finalWaypoints, corridorRadius, diagonal, tiles.isOpen() ? &tiles : NULL);
+                if (fullPath.empty()) {
+                    printf("Could not refine the route to full resolution \n");
+                } else {
+                    printf("Full resolution route from (%d, %d) to (%d, %d) with Cost: %d \n", fullPath.front().first, fullPath.front().second,
+                            fullPath.back().first, fullPath.back().second, routeCost(levels.back(), fullPath));
+                    routePath.swap(fullPath);
+                    routeFactor = levels.back().factor;
+                }
+            }
+            if (routeFile != NULL && localMinCount != INT_MAX) { // For graphit.py
+                if (!saveRoute(routeFile, routeFactor, routePath)) {
+                    printf("Could not write the route to %s \n", routeFile);
+                }
+            }
         }
     } 
     if (world_rank >= 0) {
@@ -1002,7 +1243,10 @@ int main(int argc, char** argv) {
         printf("%d Time spent %.f searching for a path \n", world_rank, spendSearchingData.count());
        printf("%d Time spent %.f broadcasting \n", world_rank, spentBroadCasting.count());
     }
+    tiles.report(world_rank);
+    statsReport(world_rank, world_size, statsPath, tracePrefix);
 
+    terrain.release();
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file
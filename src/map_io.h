@@ -0,0 +1,54 @@
+/* Running From The Night:
+Shadow maps on disk, so a run isn't tied to the map compiled in from shadow_map.h */
+#ifndef MAP_IO_H
+#define MAP_IO_H
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "pyramid.h"
+
+// Layout: 8 byte magic, int32 height, int32 width, then height * width bytes row major (0 lit, 1 shadowed)
+const char MAP_MAGIC[8] = { 'M', 'G', 'M', 'A', 'P', '1', 0, 0 };
+
+//Writes a shadow map, returns false if the file couldn't be written
+bool saveMap(const char* path, int height, int width, const std::vector<unsigned char>& shadowed) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    int dims[2] = { height, width };
+    bool ok = fwrite(MAP_MAGIC, 1, sizeof(MAP_MAGIC), f) == sizeof(MAP_MAGIC)
+            && fwrite(dims, sizeof(int), 2, f) == 2
+            && fwrite(&shadowed[0], 1, shadowed.size(), f) == shadowed.size();
+    fclose(f);
+    return ok;
+}
+
+//Reads a shadow map straight into a full resolution pyramid level, returns false if the file isn't a map
+bool loadMap(const char* path, LitLevel& full) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    char magic[8];
+    int dims[2];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, MAP_MAGIC, sizeof(magic)) != 0
+            || fread(dims, sizeof(int), 2, f) != 2 || dims[0] <= 0 || dims[1] <= 0) {
+        fclose(f);
+        return false;
+    }
+    full.factor = 1;
+    full.height = dims[0];
+    full.width = dims[1];
+    full.anyLit.resize((size_t)full.height * full.width);
+    bool ok = fread(&full.anyLit[0], 1, full.anyLit.size(), f) == full.anyLit.size();
+    fclose(f);
+    for (size_t k = 0; k < full.anyLit.size(); k++) { // Stored as shadowed, kept as lit
+        full.anyLit[k] = (full.anyLit[k] == 0);
+    }
+    full.allLit = full.anyLit;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,164 @@
+/* Running From The Night:
+One copy of the terrain per node: the pyramid and the elevation live in an MPI shared memory window that every rank on the node views */
+#ifndef NODE_SHARED_H
+#define NODE_SHARED_H
+
+#include <mpi.h>
+#include <cstring>
+#include <vector>
+#include "pyramid.h"
+#include "stats.h"
+
+class NodeTerrain {
+public:
+    NodeTerrain() : comm(MPI_COMM_NULL), win(MPI_WIN_NULL), nodeRank(0), base(NULL) {}
+
+    //Groups the ranks by node, returns true on the rank that builds the terrain for its node
+    bool begin() {
+        STAT_MPI(MPI_CALL_COMM_SPLIT_TYPE, MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &comm));
+        MPI_Comm_rank(comm, &nodeRank);
+        return nodeRank == 0;
+    }
+
+    //Tells the rest of the node whether the leader managed to build the terrain
+    bool agree(bool built) {
+        int ok = built;
+        STAT_MPI(MPI_CALL_BCAST, MPI_Bcast(&ok, 1, MPI_INT, 0, comm));
+        return ok != 0;
+    }
+
+    //Moves the levels and the elevation the leader built into the window, every rank on the node (the leader too)
+    //ends up with views of it. Before the leader copies anything in, every rank touches the rows from bandBegin to
+    //bandEnd (fractions of the height) of every raster, so on NUMA machines those pages sit next to the rank that
+    //searches them. Rasters a rank replaces later become private to that rank, see rebuildCosts for the cost model
+    void share(std::vector<LitLevel>& levels, Raster<short>& dem, double bandBegin, double bandEnd) {
+        std::vector<long long> layout; // Number of levels, then factor, height, width, has cells, has cost for each, then elevation cells
+        if (nodeRank == 0) {
+            layout.push_back((long long)levels.size());
+            for (size_t l = 0; l < levels.size(); l++) {
+                layout.push_back(levels[l].factor);
+                layout.push_back(levels[l].height);
+                layout.push_back(levels[l].width);
+                layout.push_back(levels[l].anyLit.empty() ? 0 : 1); // 0 when the level stays on disk (see tile_store.h)
+                layout.push_back(levels[l].cost.empty() ? 0 : 1);
+            }
+            layout.push_back((long long)dem.size());
+        }
+        long long layoutSize = (long long)layout.size();
+        STAT_MPI(MPI_CALL_BCAST, MPI_Bcast(&layoutSize, 1, MPI_LONG_LONG, 0, comm));
+        layout.resize((size_t)layoutSize);
+        STAT_MPI(MPI_CALL_BCAST, MPI_Bcast(&layout[0], (int)layoutSize, MPI_LONG_LONG, 0, comm));
+
+        size_t numLevels = (size_t)layout[0];
+        levels.resize(numLevels);
+        std::vector<Slice> slices;
+        size_t total = 0;
+        costOffsets.assign(numLevels, -1);
+        for (size_t l = 0; l < numLevels; l++) {
+            LitLevel& level = levels[l];
+            level.factor = (int)layout[1 + 5 * l];
+            level.height = (int)layout[2 + 5 * l];
+            level.width = (int)layout[3 + 5 * l];
+            size_t cells = (size_t)level.height * level.width;
+            if (layout[4 + 5 * l] != 0) {
+                addSlice(slices, total, &level.anyLit, NULL, level.height, cells);
+                addSlice(slices, total, &level.allLit, NULL, level.height, cells);
+            }
+            if (layout[5 + 5 * l] != 0) {
+                costOffsets[l] = (long long)total;
+                addSlice(slices, total, &level.cost, NULL, level.height, cells);
+            }
+        }
+        if (layout.back() > 0) {
+            addSlice(slices, total, NULL, &dem, levels.back().height, (size_t)layout.back() * sizeof(short));
+        }
+
+        STAT_MPI(MPI_CALL_WIN_ALLOCATE_SHARED, MPI_Win_allocate_shared(nodeRank == 0 ? (MPI_Aint)total : 0, 1, MPI_INFO_NULL, comm, &base, &win));
+        MPI_Aint size;
+        int unit;
+        MPI_Win_shared_query(win, 0, &size, &unit, &base);
+
+        STAT_MPI(MPI_CALL_WIN_FENCE, MPI_Win_fence(0, win));
+        for (size_t s = 0; s < slices.size(); s++) { // First touch of this rank's rows
+            size_t rowBytes = slices[s].bytes / slices[s].rows;
+            size_t first = (size_t)(bandBegin * slices[s].rows) * rowBytes;
+            size_t last = std::min((size_t)(bandEnd * slices[s].rows + 0.999) * rowBytes, slices[s].bytes);
+            if (last > first) {
+                memset(base + slices[s].offset + first, 0, last - first);
+            }
+        }
+        STAT_MPI(MPI_CALL_WIN_FENCE, MPI_Win_fence(0, win));
+        if (nodeRank == 0) {
+            for (size_t s = 0; s < slices.size(); s++) {
+                const void* from = slices[s].cells != NULL ? (const void*)slices[s].cells->data() : (const void*)slices[s].elevation->data();
+                memcpy(base + slices[s].offset, from, slices[s].bytes);
+            }
+        }
+        STAT_MPI(MPI_CALL_WIN_FENCE, MPI_Win_fence(0, win));
+        for (size_t s = 0; s < slices.size(); s++) {
+            if (slices[s].cells != NULL) {
+                slices[s].cells->view((unsigned char*)(base + slices[s].offset), slices[s].bytes);
+            } else {
+                slices[s].elevation->view((short*)(base + slices[s].offset), slices[s].bytes / sizeof(short));
+            }
+        }
+    }
+
+    //Rebuilds the cost rasters of the levels with rebuild, every rank on the node has to call it. When the levels
+    //were shared with their costs the leader runs rebuild and copies the result into the window, so the node keeps
+    //one copy. Otherwise (a tiled map) every rank runs rebuild and keeps its own
+    template <class Rebuild>
+    void rebuildCosts(std::vector<LitLevel>& levels, Rebuild rebuild) {
+        bool shared = !costOffsets.empty();
+        for (size_t l = 0; l < costOffsets.size(); l++) {
+            shared = shared && costOffsets[l] >= 0;
+        }
+        if (!shared) {
+            rebuild();
+            return;
+        }
+        STAT_MPI(MPI_CALL_WIN_FENCE, MPI_Win_fence(0, win)); // Nobody reads the old costs past here
+        if (nodeRank == 0) {
+            rebuild();
+            for (size_t l = 0; l < levels.size(); l++) {
+                char* cells = base + costOffsets[l];
+                memcpy(cells, levels[l].cost.data(), levels[l].cost.size());
+                levels[l].cost.view((unsigned char*)cells, levels[l].cost.size());
+            }
+        }
+        STAT_MPI(MPI_CALL_WIN_FENCE, MPI_Win_fence(0, win));
+    }
+
+    //Frees the window, nothing shared may be looked at afterwards
+    void release() {
+        if (win != MPI_WIN_NULL) {
+            STAT_MPI(MPI_CALL_WIN_FREE, MPI_Win_free(&win));
+        }
+        if (comm != MPI_COMM_NULL) {
+            STAT_MPI(MPI_CALL_COMM_FREE, MPI_Comm_free(&comm));
+        }
+    }
+
+private:
+    MPI_Comm comm; // Ranks on this node
+    MPI_Win win;
+    int nodeRank;
+    char* base; // Of the window, as the leader allocated it
+    std::vector<long long> costOffsets; // Per level, where its cost raster sits in the window, -1 if it isn't there
+
+    // Where one raster goes in the window
+    struct Slice {
+        Raster<unsigned char>* cells; // Either this
+        Raster<short>* elevation; // or this
+        int rows;
+        size_t offset, bytes;
+    };
+
+    static void addSlice(std::vector<Slice>& slices, size_t& total, Raster<unsigned char>* cells, Raster<short>* elevation, int rows, size_t bytes) {
+        Slice s = { cells, elevation, std::max(rows, 1), total, bytes };
+        slices.push_back(s);
+        total += (bytes + 63) & ~(size_t)63; // Cache line aligned
+    }
+};
+
+#endif
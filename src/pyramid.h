@@ -0,0 +1,201 @@
+/* Running From The Night:
+Multi-resolution lit/shadow pyramid used for coarse-to-fine route planning */
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <algorithm>
+#include <vector>
+#include <utility>
+#include <cstdlib>
+
+// Cells of a raster, either owned or a view of memory owned by someone else (the node's shared window, see
+// node_shared.h). Copying a view copies the pointer, anything that replaces the contents makes it owned again
+template <typename T>
+class Raster {
+public:
+    Raster() : cells(NULL), count(0), isView(false) {}
+    Raster(const std::vector<T>& v) : owned(v), isView(false) {
+        point();
+    }
+    Raster(std::vector<T>&& v) : owned(std::move(v)), isView(false) {
+        point();
+    }
+    Raster(const Raster& other) : owned(other.owned), cells(other.cells), count(other.count), isView(other.isView) {
+        if (!isView) {
+            point();
+        }
+    }
+    Raster(Raster&& other) : cells(NULL), count(0), isView(false) {
+        swap(other);
+    }
+    Raster& operator=(Raster other) {
+        swap(other);
+        return *this;
+    }
+
+    T& operator[](size_t k) {
+        return cells[k];
+    }
+    const T& operator[](size_t k) const {
+        return cells[k];
+    }
+    size_t size() const {
+        return count;
+    }
+    bool empty() const {
+        return count == 0;
+    }
+    const T* data() const {
+        return cells;
+    }
+    bool shared() const {
+        return isView;
+    }
+
+    void resize(size_t n) {
+        detach();
+        owned.resize(n);
+        point();
+    }
+    void assign(size_t n, T value) {
+        isView = false;
+        owned.assign(n, value);
+        point();
+    }
+
+    //Drops the owned cells and looks at n cells at p instead
+    void view(T* p, size_t n) {
+        std::vector<T>().swap(owned);
+        cells = p;
+        count = n;
+        isView = true;
+    }
+
+    void swap(Raster& other) { // Vectors keep their buffers when swapped, so the pointers stay right
+        owned.swap(other.owned);
+        std::swap(cells, other.cells);
+        std::swap(count, other.count);
+        std::swap(isView, other.isView);
+    }
+
+private:
+    std::vector<T> owned;
+    T* cells;
+    size_t count;
+    bool isView;
+
+    void point() {
+        cells = owned.empty() ? NULL : &owned[0];
+        count = owned.size();
+    }
+    void detach() {
+        if (isView) {
+            owned.assign(cells, cells + count);
+            isView = false;
+        }
+    }
+};
+
+// One level of the pyramid, every cell covers a factor x factor block of the full grid
+struct LitLevel {
+    int factor;
+    int height, width;
+    Raster<unsigned char> anyLit; // 1 if any full resolution cell in the block is lit (never closes a passage)
+    Raster<unsigned char> allLit; // 1 if every full resolution cell in the block is lit (never opens a passage)
+    Raster<unsigned char> cost; // Cost of stepping onto each cell, empty when every step costs 1
+};
+
+//Builds the full resolution level from a grid where 0 is lit and 1 is shadowed
+LitLevel buildFullLevel(const int* cells, int height, int width, int stride) {
+    LitLevel level;
+    level.factor = 1;
+    level.height = height;
+    level.width = width;
+    level.anyLit.resize((size_t)height * width);
+    for (int i = 0; i < height; i++) {
+        const int* row = cells + (size_t)i * stride;
+        unsigned char* out = &level.anyLit[(size_t)i * width];
+        for (int j = 0; j < width; j++) {
+            out[j] = (row[j] == 0);
+        }
+    }
+    level.allLit = level.anyLit;
+    return level;
+}
+
+//Downsamples a level by ratio, a partial block at the bottom/right edge is still its own cell
+LitLevel downsampleLevel(const LitLevel& fine, int ratio) {
+    LitLevel level;
+    level.factor = fine.factor * ratio;
+    level.height = (fine.height + ratio - 1) / ratio;
+    level.width = (fine.width + ratio - 1) / ratio;
+    level.anyLit.assign((size_t)level.height * level.width, 0);
+    level.allLit.assign((size_t)level.height * level.width, 1);
+    for (int i = 0; i < fine.height; i++) {
+        unsigned char* anyOut = &level.anyLit[(size_t)(i / ratio) * level.width];
+        unsigned char* allOut = &level.allLit[(size_t)(i / ratio) * level.width];
+        const unsigned char* anyIn = &fine.anyLit[(size_t)i * fine.width];
+        const unsigned char* allIn = &fine.allLit[(size_t)i * fine.width];
+        for (int j = 0; j < fine.width; j++) {
+            anyOut[j / ratio] |= anyIn[j];
+            allOut[j / ratio] &= allIn[j];
+        }
+    }
+    return level;
+}
+
+//Builds the 1/16, 1/4 and 1/1 levels from the full resolution level, returned coarsest first
+std::vector<LitLevel> buildLitPyramid(const LitLevel& full) {
+    std::vector<LitLevel> levels(3);
+    levels[2] = full;
+    levels[1] = downsampleLevel(levels[2], 4);
+    levels[0] = downsampleLevel(levels[1], 4);
+    return levels;
+}
+
+std::vector<LitLevel> buildLitPyramid(const int* cells, int height, int width, int stride) {
+    return buildLitPyramid(buildFullLevel(cells, height, width, stride));
+}
+
+//Marks the cells of coarse within radius (chebyshev) of the coarse path
+std::vector<unsigned char> corridorMask(const LitLevel& coarse, const std::vector<std::pair<int, int> >& coarsePath, int radius) {
+    std::vector<unsigned char> coarseMask((size_t)coarse.height * coarse.width, 0);
+    for (size_t p = 0; p < coarsePath.size(); p++) {
+        int x0 = std::max(coarsePath[p].first - radius, 0);
+        int x1 = std::min(coarsePath[p].first + radius, coarse.height - 1);
+        int y0 = std::max(coarsePath[p].second - radius, 0);
+        int y1 = std::min(coarsePath[p].second + radius, coarse.width - 1);
+        for (int i = x0; i <= x1; i++) {
+            for (int j = y0; j <= y1; j++) {
+                coarseMask[(size_t)i * coarse.width + j] = 1;
+            }
+        }
+    }
+    return coarseMask;
+}
+
+//Maps a coarse cell to a lit cell inside the corridor of the fine level, preferring the one closest to the block centre.
+//Returns (-1, -1) if nothing within radius fine cells of the centre is usable
+std::pair<int, int> snapToLit(const LitLevel& fine, const std::vector<unsigned char>& corridor, int ratio, int x, int y, int radius) {
+    int cx = std::min(x * ratio + ratio / 2, fine.height - 1);
+    int cy = std::min(y * ratio + ratio / 2, fine.width - 1);
+    for (int r = 0; r <= radius; r++) { // Walk outwards ring by ring
+        for (int i = cx - r; i <= cx + r; i++) {
+            for (int j = cy - r; j <= cy + r; j++) {
+                if (std::abs(i - cx) != r && std::abs(j - cy) != r) {
+                    continue;
+                }
+                if (i < 0 || j < 0 || i >= fine.height || j >= fine.width) {
+                    continue;
+                }
+                size_t idx = (size_t)i * fine.width + j;
+                if (fine.anyLit[idx] && corridor[idx]) {
+                    return std::make_pair(i, j);
+                }
+            }
+        }
+    }
+    return std::make_pair(-1, -1);
+}
+
+#endif
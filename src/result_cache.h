@@ -0,0 +1,269 @@
+/* Running From The Night:
+Content addressed cache of a rank's search results: antenna candidates, lit component labels and leg costs, memory mapped on load */
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Layout: CacheHeader, int32 counts[numGroups], int32 (x, y) candidates[numCandidates] group after group,
+// int32 labels[numLabels], then CachedLeg legs[numLegs] sorted by cells. Every section is 8 byte aligned
+const char CACHE_MAGIC[8] = { 'M', 'G', 'C', 'A', 'C', 'H', 'E', '1' };
+const unsigned long long CACHE_HASH_SEED = 1469598103934665603ULL;
+
+struct CacheHeader {
+    char magic[8];
+    unsigned long long key;
+    long long numGroups;
+    long long numCandidates;
+    long long numLabels;
+    long long numLegs;
+};
+
+struct CachedLeg {
+    unsigned long long cells; // Level cell (x * width + y) the leg starts from << 32 | cell it goes to
+    long long cost; // As returned by the search, -1 if there is no path
+};
+
+//FNV-1a, chain several buffers into one key by passing the last hash as the seed
+unsigned long long hashBytes(const void* data, size_t n, unsigned long long seed = CACHE_HASH_SEED) {
+    const unsigned char* p = (const unsigned char*)data;
+    unsigned long long h = seed;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+//Hashes the elements of a vector or a Raster
+template<typename V>
+unsigned long long hashVector(const V& v, unsigned long long seed) {
+    return v.empty() ? seed : hashBytes(&v[0], v.size() * sizeof(v[0]), seed);
+}
+
+//Path of the cache file for a key under dir
+std::string cachePath(const char* dir, unsigned long long key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.mgc", key);
+    return std::string(dir) + "/" + name;
+}
+
+class ResultCache {
+public:
+    ResultCache() : data(NULL), size(0), mapped(false), header(NULL) {}
+
+    ~ResultCache() {
+        unload();
+    }
+
+    //Loads the cache file at path, returns false if it is missing, damaged or was written for another key
+    bool load(const std::string& path, unsigned long long key) {
+        unload();
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CacheHeader)) {
+            void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                data = (const char*)p;
+                size = (size_t)st.st_size;
+                mapped = true;
+            }
+        }
+        close(fd);
+#else
+        FILE* f = fopen(path.c_str(), "rb");
+        if (f == NULL) {
+            return false;
+        }
+        fseek(f, 0, SEEK_END);
+        long n = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (n >= (long)sizeof(CacheHeader)) {
+            copy.resize(((size_t)n + 7) / 8);
+            if (fread(&copy[0], 1, (size_t)n, f) == (size_t)n) {
+                data = (const char*)&copy[0];
+                size = (size_t)n;
+            }
+        }
+        fclose(f);
+#endif
+        if (data == NULL) {
+            return false;
+        }
+        header = (const CacheHeader*)data;
+        size_t expected = sizeof(CacheHeader) + align((size_t)header->numGroups * sizeof(int)) + align((size_t)header->numCandidates * 2 * sizeof(int))
+                + align((size_t)header->numLabels * sizeof(int)) + (size_t)header->numLegs * sizeof(CachedLeg);
+        if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header->key != key || header->numGroups < 0 || expected != size) {
+            unload();
+            return false;
+        }
+        return true;
+    }
+
+    bool loaded() const {
+        return header != NULL;
+    }
+
+    //Antenna candidates per group as found (and ranked) by the run that wrote the cache
+    void candidates(std::vector<std::vector<std::pair<int, int> > >& antennaList, std::vector<int>& counts) const {
+        const int* c = countSection();
+        const int* xy = candidateSection();
+        counts.assign(c, c + header->numGroups);
+        antennaList.assign(counts.size(), std::vector<std::pair<int, int> >());
+        for (size_t g = 0; g < counts.size(); g++) {
+            for (int k = 0; k < counts[g]; k++, xy += 2) {
+                antennaList[g].push_back(std::make_pair(xy[0], xy[1]));
+            }
+        }
+    }
+
+    std::vector<int> labels() const {
+        const int* l = labelSection();
+        return std::vector<int>(l, l + header->numLabels);
+    }
+
+    //Cost of the leg between two level cells, -2 if it isn't known yet
+    int leg(int from, int to) const {
+        unsigned long long cells = legCells(from, to);
+        if (loaded()) {
+            const CachedLeg* first = legSection();
+            const CachedLeg* last = first + header->numLegs;
+            const CachedLeg* it = std::lower_bound(first, last, cells, [](const CachedLeg& l, unsigned long long c) { return l.cells < c; });
+            if (it != last && it->cells == cells) {
+                return (int)it->cost;
+            }
+        }
+        std::unordered_map<unsigned long long, int>::const_iterator it = added.find(cells);
+        return it != added.end() ? it->second : -2;
+    }
+
+    void addLeg(int from, int to, int cost) {
+        added[legCells(from, to)] = cost;
+    }
+
+    //Number of legs searched since the cache was loaded
+    size_t newLegs() const {
+        return added.size();
+    }
+
+    //Writes the candidates, labels and every known leg for key to path. Goes through a temporary file that is
+    //renamed over the old one so ranks mapping it never see half a file
+    bool save(const std::string& path, unsigned long long key, const std::vector<std::vector<std::pair<int, int> > >& antennaList,
+                const std::vector<int>& counts, const std::vector<int>& labels) const {
+        std::vector<CachedLeg> legs;
+        if (loaded()) {
+            legs.assign(legSection(), legSection() + header->numLegs);
+        }
+        for (std::unordered_map<unsigned long long, int>::const_iterator it = added.begin(); it != added.end(); ++it) {
+            CachedLeg l = { it->first, it->second };
+            legs.push_back(l);
+        }
+        std::sort(legs.begin(), legs.end(), [](const CachedLeg& a, const CachedLeg& b) { return a.cells < b.cells; });
+
+        std::vector<int> xy;
+        for (size_t g = 0; g < counts.size(); g++) {
+            for (int k = 0; k < counts[g]; k++) {
+                xy.push_back(antennaList[g][k].first);
+                xy.push_back(antennaList[g][k].second);
+            }
+        }
+        CacheHeader h;
+        memcpy(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        h.key = key;
+        h.numGroups = (long long)counts.size();
+        h.numCandidates = (long long)xy.size() / 2;
+        h.numLabels = (long long)labels.size();
+        h.numLegs = (long long)legs.size();
+
+        std::string temp = path + ".tmp";
+        FILE* f = fopen(temp.c_str(), "wb");
+        if (f == NULL) {
+            return false;
+        }
+        fwrite(&h, sizeof(h), 1, f);
+        writeSection(f, counts.empty() ? NULL : &counts[0], counts.size() * sizeof(int));
+        writeSection(f, xy.empty() ? NULL : &xy[0], xy.size() * sizeof(int));
+        writeSection(f, labels.empty() ? NULL : &labels[0], labels.size() * sizeof(int));
+        writeSection(f, legs.empty() ? NULL : &legs[0], legs.size() * sizeof(CachedLeg));
+        bool ok = ferror(f) == 0;
+        fclose(f);
+        if (!ok) {
+            remove(temp.c_str());
+            return false;
+        }
+#ifdef _WIN32
+        remove(path.c_str()); // rename doesn't replace on Windows
+#endif
+        return rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+private:
+    const char* data;
+    size_t size;
+    bool mapped;
+    std::vector<unsigned long long> copy; // The file when it can't be mapped
+    const CacheHeader* header;
+    std::unordered_map<unsigned long long, int> added; // Legs searched by this run
+
+    static size_t align(size_t n) {
+        return (n + 7) & ~(size_t)7;
+    }
+
+    static unsigned long long legCells(int from, int to) {
+        return ((unsigned long long)(unsigned)from << 32) | (unsigned)to;
+    }
+
+    static void writeSection(FILE* f, const void* p, size_t n) {
+        static const char zeros[8] = { 0 };
+        if (n > 0) {
+            fwrite(p, 1, n, f);
+        }
+        fwrite(zeros, 1, align(n) - n, f);
+    }
+
+    const int* countSection() const {
+        return (const int*)(data + sizeof(CacheHeader));
+    }
+
+    const int* candidateSection() const {
+        return (const int*)((const char*)countSection() + align((size_t)header->numGroups * sizeof(int)));
+    }
+
+    const int* labelSection() const {
+        return (const int*)((const char*)candidateSection() + align((size_t)header->numCandidates * 2 * sizeof(int)));
+    }
+
+    const CachedLeg* legSection() const {
+        return (const CachedLeg*)((const char*)labelSection() + align((size_t)header->numLabels * sizeof(int)));
+    }
+
+    void unload() {
+#ifndef _WIN32
+        if (mapped) {
+            munmap((void*)data, size);
+        }
+#endif
+        copy.clear();
+        data = NULL;
+        size = 0;
+        mapped = false;
+        header = NULL;
+    }
+};
+
+#endif
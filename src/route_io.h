@@ -0,0 +1,120 @@
+/* Running From The Night:
+Routes on disk as a start cell and a run length encoded stream of moves, written as the path is walked */
+#ifndef ROUTE_IO_H
+#define ROUTE_IO_H
+
+#include <cstdio>
+#include <vector>
+#include <utility>
+
+// Layout: 8 byte magic, int32 factor (full resolution cells per cell of the route's level), int32 start_x,
+// int32 start_y, then one byte per run of identical moves until the end of the file. The top 3 bits of a run
+// are the direction (ROUTE_MOVES), the low 5 bits the run length - 1, longer runs are split
+const char ROUTE_MAGIC[8] = { 'M', 'G', 'R', 'O', 'U', 'T', 'E', '1' };
+const int ROUTE_MOVES[8][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 }, { -1, -1 }, { -1, 1 }, { 1, -1 }, { 1, 1 } };
+const int ROUTE_MAX_RUN = 32;
+
+class RouteWriter {
+public:
+    RouteWriter() : f(NULL), x(0), y(0), direction(-1), run(0) {}
+
+    ~RouteWriter() {
+        close();
+    }
+
+    //Starts a route at (start_x, start_y), returns false if the file couldn't be opened
+    bool open(const char* path, int factor, int start_x, int start_y) {
+        f = fopen(path, "wb");
+        if (f == NULL) {
+            return false;
+        }
+        int header[3] = { factor, start_x, start_y };
+        fwrite(ROUTE_MAGIC, 1, sizeof(ROUTE_MAGIC), f);
+        fwrite(header, sizeof(int), 3, f);
+        x = start_x;
+        y = start_y;
+        direction = -1;
+        run = 0;
+        return true;
+    }
+
+    //Appends the next cell of the route, which has to be one of the 8 neighbours of the last one
+    bool step(int next_x, int next_y) {
+        int d = moveCode(next_x - x, next_y - y);
+        if (d == -1) {
+            return false;
+        }
+        if (d != direction || run == ROUTE_MAX_RUN) {
+            flushRun();
+            direction = d;
+        }
+        run++;
+        x = next_x;
+        y = next_y;
+        return true;
+    }
+
+    //Flushes the last run and closes the file, returns false if anything failed to write
+    bool close() {
+        if (f == NULL) {
+            return true;
+        }
+        flushRun();
+        flushBuffer();
+        bool ok = ferror(f) == 0;
+        fclose(f);
+        f = NULL;
+        return ok;
+    }
+
+private:
+    FILE* f;
+    int x, y; // Last cell written
+    int direction; // Of the run being built, -1 before the first move
+    int run;
+    std::vector<unsigned char> buffer; // Runs not yet written out
+
+    static int moveCode(int dx, int dy) {
+        for (int d = 0; d < 8; d++) {
+            if (ROUTE_MOVES[d][0] == dx && ROUTE_MOVES[d][1] == dy) {
+                return d;
+            }
+        }
+        return -1;
+    }
+
+    void flushRun() {
+        if (run > 0) {
+            buffer.push_back((unsigned char)((direction << 5) | (run - 1)));
+            run = 0;
+            if (buffer.size() >= 4096) {
+                flushBuffer();
+            }
+        }
+    }
+
+    void flushBuffer() {
+        if (!buffer.empty()) {
+            fwrite(&buffer[0], 1, buffer.size(), f);
+            buffer.clear();
+        }
+    }
+};
+
+//Streams a path (start first) to a route file, returns false if it couldn't be written
+bool saveRoute(const char* path, int factor, const std::vector<std::pair<int, int> >& route) {
+    if (route.empty()) {
+        return false;
+    }
+    RouteWriter writer;
+    if (!writer.open(path, factor, route[0].first, route[0].second)) {
+        return false;
+    }
+    bool ok = true;
+    for (size_t p = 1; p < route.size() && ok; p++) {
+        ok = writer.step(route[p].first, route[p].second);
+    }
+    return writer.close() && ok;
+}
+
+#endif
@@ -0,0 +1,523 @@
+/* Running From The Night:
+One A* kernel for every search, specialized at compile time on connectivity, heuristic and goal */
+#ifndef SEARCH_KERNEL_H
+#define SEARCH_KERNEL_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+#include <utility>
+#include "pyramid.h"
+#include "bucket_queue.h"
+#include "stats.h"
+
+// The grid gets a one cell border of blocked cells so a neighbour is never out of bounds, cells are flat indices
+struct PaddedGrid {
+    int height, width; // Unpadded size of the level
+    int top, bottom; // Rows held, from top to bottom exclusive. Rows outside are blocked and not stored
+    int stride; // width + 2
+    std::vector<unsigned char> step; // Cost of stepping onto each cell, 0 if it is blocked or in the border
+
+    int cell(int x, int y) const {
+        return (x - top + 1) * stride + y + 1;
+    }
+    int row(int cell) const {
+        return cell / stride - 1 + top;
+    }
+    int col(int cell) const {
+        return cell % stride - 1;
+    }
+};
+
+//Pads a level, blocking the cells with no lit ground and the cells outside corridor (if given). Only the rows from
+//startingHeight to endingHeight are held, with a blocked row on either side
+PaddedGrid buildPaddedGrid(const LitLevel& level, const std::vector<unsigned char>* corridor, int startingHeight, int endingHeight) {
+    PaddedGrid grid;
+    grid.height = level.height;
+    grid.width = level.width;
+    grid.top = std::min(std::max(startingHeight, 0), level.height);
+    grid.bottom = std::max(std::min(endingHeight, level.height), grid.top);
+    grid.stride = level.width + 2;
+    grid.step.assign((size_t)(grid.bottom - grid.top + 2) * grid.stride, 0);
+    for (int i = grid.top; i < grid.bottom; i++) {
+        const unsigned char* lit = &level.anyLit[(size_t)i * level.width];
+        const unsigned char* cost = level.cost.empty() ? NULL : &level.cost[(size_t)i * level.width];
+        const unsigned char* inside = corridor == NULL ? NULL : &(*corridor)[(size_t)i * level.width];
+        unsigned char* out = &grid.step[grid.cell(i, 0)];
+        for (int j = 0; j < level.width; j++) {
+            bool open = lit[j] && (inside == NULL || inside[j]);
+            out[j] = open ? (cost == NULL ? 1 : cost[j]) : 0;
+        }
+    }
+    return grid;
+}
+
+// Cost of a step onto a cell of weight w. Diagonals are sqrt(2) longer, for integer costs that is rounded so
+// a diagonal onto a weight 1 cell still costs 1. Only integer costs are specialized: every weight is a uint8 of
+// the cost raster, so sums stay exact and the frontier can be a bucket queue. A float cost type would need its own
+// StepCost and KernelFrontier (a binary heap) and nothing would search with it
+template <typename CostT>
+struct StepCost;
+
+template <>
+struct StepCost<int> {
+    static int orthogonal(int w) {
+        return w;
+    }
+    static int diagonal(int w) {
+        return (w * 141 + 50) / 100;
+    }
+};
+
+struct FourConnected {
+    static const bool diagonals = false;
+};
+
+// Diagonal steps may not cut the corner of a blocked cell
+struct EightConnected {
+    static const bool diagonals = true;
+};
+
+// Heuristics take unpadded coordinates and must never overestimate with every weight at least 1. One that prunes
+// returns a negative estimate for cells that can't reach the goal at all
+
+struct NoHeuristic {
+    static const bool prunes = false;
+
+    template <typename CostT>
+    CostT estimate(int x, int y) const {
+        (void)x;
+        (void)y;
+        return 0;
+    }
+};
+
+// Only admissible for 4-connectivity
+struct ManhattanHeuristic {
+    static const bool prunes = false;
+    int goal_x, goal_y;
+
+    template <typename CostT>
+    CostT estimate(int x, int y) const {
+        return (CostT)(std::abs(goal_x - x) + std::abs(goal_y - y));
+    }
+};
+
+// A diagonal onto a weight 1 cell costs 1 like a straight step, so the cheapest unit cost path to the goal is the
+// Chebyshev distance
+struct ChebyshevHeuristic {
+    static const bool prunes = false;
+    int goal_x, goal_y;
+
+    template <typename CostT>
+    CostT estimate(int x, int y) const {
+        return (CostT)std::max(std::abs(goal_x - x), std::abs(goal_y - y));
+    }
+};
+
+// Every step moves at most one column, for either connectivity
+struct ColumnHeuristic {
+    static const bool prunes = false;
+    int column;
+
+    template <typename CostT>
+    CostT estimate(int x, int y) const {
+        (void)x;
+        return (CostT)std::abs(column - y);
+    }
+};
+
+// Exact remaining cost read off a distance field (see distanceField), -1 where the field's seeds can't be reached
+struct FieldHeuristic {
+    static const bool prunes = true;
+    const int* field; // Indexed by padded cell
+    int stride;
+    int top; // First row of the grid
+
+    template <typename CostT>
+    CostT estimate(int x, int y) const {
+        return (CostT)field[(x - top + 1) * stride + y + 1];
+    }
+};
+
+// Goals test padded cells. A point goal can be stepped onto even when it is blocked, routes may end in shadow on the
+// east edge like they always have. The other goals only count open cells. The search stops at the first goal cell
+// popped for which finished() is true
+
+struct PointGoal {
+    static const bool entersBlocked = true;
+    int target;
+
+    bool reached(int cell) const {
+        return cell == target;
+    }
+    bool finished() const {
+        return true;
+    }
+};
+
+struct ColumnGoal {
+    static const bool entersBlocked = false;
+    int column; // Unpadded
+    int stride;
+
+    bool reached(int cell) const {
+        return cell % stride - 1 == column;
+    }
+    bool finished() const {
+        return true;
+    }
+};
+
+// Several point goals, the search goes on until every one of them has been popped (or can't be reached). Each goal
+// cell is popped once, so remaining counts down to 0 at the last one
+struct MultiPointGoal {
+    static const bool entersBlocked = true;
+    const unsigned char* cells; // Indexed by padded cell, non zero for goal cells
+    int* remaining; // Distinct goal cells not popped yet
+
+    bool reached(int cell) const {
+        return cells[cell] != 0;
+    }
+    bool finished() const {
+        return --*remaining == 0;
+    }
+};
+
+// The seeds of a distance field are the only cells at distance 0, like a point goal they may be in shadow
+struct FieldGoal {
+    static const bool entersBlocked = true;
+    const int* field;
+
+    bool reached(int cell) const {
+        return field[cell] == 0;
+    }
+    bool finished() const {
+        return true;
+    }
+};
+
+// Search scratch reused across searches over grids of the same size. A cell is only reached if its stamp is the
+// current epoch, so starting a search doesn't clear anything
+template <typename CostT>
+struct SearchState {
+    std::vector<CostT> cost;
+    std::vector<int> parent; // Starts are their own parent
+    std::vector<unsigned int> stamp;
+    unsigned int epoch;
+
+    SearchState() : epoch(0) {}
+
+    void begin(size_t cells) {
+        if (stamp.size() != cells) {
+            cost.resize(cells);
+            parent.resize(cells);
+            stamp.assign(cells, 0);
+            epoch = 0;
+        }
+        if (++epoch == 0) { // Wrapped around, every old stamp could look current
+            std::fill(stamp.begin(), stamp.end(), 0);
+            epoch = 1;
+        }
+    }
+
+    bool reached(int cell) const {
+        return stamp[cell] == epoch;
+    }
+};
+
+template <typename CostT>
+struct KernelEntry {
+    CostT priority; // cost + heuristic
+    CostT cost;
+    int cell;
+
+    // Ties go to the deeper entry
+    bool operator>(const KernelEntry& other) const {
+        return priority > other.priority || (priority == other.priority && cost < other.cost);
+    }
+};
+
+struct KernelEntryPriority {
+    int operator()(const KernelEntry<int>& e) const {
+        return e.priority;
+    }
+};
+
+// Costs are integers, so the frontier is a bucket queue
+template <typename CostT>
+struct KernelFrontier;
+
+template <>
+struct KernelFrontier<int> {
+    typedef BucketQueue<KernelEntry<int>, KernelEntryPriority> type;
+};
+
+//A* from every one of starts (padded cells, all at cost 0) until a cell that satisfies the goal is popped.
+//Returns that cell or -1 if none can be reached, the costs and parents of the searched cells are left in state
+template <typename Connectivity, typename CostT, typename Heuristic, typename Goal>
+int searchGrid(const PaddedGrid& grid, SearchState<CostT>& state, const std::vector<int>& starts, const Heuristic& heuristic, const Goal& goal) {
+    typedef KernelEntry<CostT> Entry;
+    typename KernelFrontier<CostT>::type frontier;
+    const unsigned char* step = &grid.step[0];
+    const int s = grid.stride;
+    const int top = grid.top;
+    state.begin(grid.step.size());
+    STAT_ADD(searches, 1);
+
+    for (size_t k = 0; k < starts.size(); k++) {
+        int c = starts[k];
+        CostT h = heuristic.template estimate<CostT>(grid.row(c), grid.col(c));
+        if (step[c] != 0 && !state.reached(c) && !(Heuristic::prunes && h < 0)) {
+            state.stamp[c] = state.epoch;
+            state.cost[c] = 0;
+            state.parent[c] = c;
+            Entry e = { h, 0, c };
+            frontier.push(e);
+            STAT_ADD(pushes, 1);
+        }
+    }
+
+    while (!frontier.empty()) {
+        Entry current = frontier.top();
+        frontier.pop();
+        STAT_ADD(expansions, 1);
+        int c = current.cell;
+        if (current.cost > state.cost[c]) { // Already reached more cheaply
+            STAT_ADD(stalePops, 1);
+            continue;
+        }
+        if (goal.reached(c) && goal.finished()) {
+            return c;
+        }
+        if (step[c] == 0) { // A blocked goal that was stepped onto, nothing leaves it
+            continue;
+        }
+        int r = c / s;
+        int x = r - 1 + top;
+        int y = c - r * s - 1;
+
+        // Relaxes the step onto next at (nx, ny), diagonal is a constant at every call so the branches fold away
+        auto relax = [&](int next, int nx, int ny, bool diagonal) {
+            int w = step[next];
+            if (w == 0) {
+                if (!Goal::entersBlocked || !goal.reached(next)) {
+                    return;
+                }
+                w = 1;
+            }
+            CostT newCost = current.cost + (diagonal ? StepCost<CostT>::diagonal(w) : StepCost<CostT>::orthogonal(w));
+            if (!state.reached(next) || newCost < state.cost[next]) {
+                CostT h = heuristic.template estimate<CostT>(nx, ny);
+                if (Heuristic::prunes && h < 0) {
+                    return;
+                }
+                state.stamp[next] = state.epoch;
+                state.cost[next] = newCost;
+                state.parent[next] = c;
+                Entry e = { newCost + h, newCost, next };
+                frontier.push(e);
+                STAT_ADD(pushes, 1);
+            }
+        };
+
+        relax(c - s, x - 1, y, false);
+        relax(c + s, x + 1, y, false);
+        relax(c - 1, x, y - 1, false);
+        relax(c + 1, x, y + 1, false);
+        if (Connectivity::diagonals) {
+            bool up = step[c - s] != 0, down = step[c + s] != 0, left = step[c - 1] != 0, right = step[c + 1] != 0;
+            if (up && left) {
+                relax(c - s - 1, x - 1, y - 1, true);
+            }
+            if (up && right) {
+                relax(c - s + 1, x - 1, y + 1, true);
+            }
+            if (down && left) {
+                relax(c + s - 1, x + 1, y - 1, true);
+            }
+            if (down && right) {
+                relax(c + s + 1, x + 1, y + 1, true);
+            }
+        }
+    }
+    STAT_ADD(failedSearches, 1);
+    return -1;
+}
+
+//Walks the parents back from cell to its start, returns the path start first in unpadded coordinates
+template <typename CostT>
+std::vector<std::pair<int, int> > tracePath(const PaddedGrid& grid, const SearchState<CostT>& state, int cell) {
+    std::vector<std::pair<int, int> > path;
+    path.push_back(std::make_pair(grid.row(cell), grid.col(cell)));
+    while (state.parent[cell] != cell) {
+        cell = state.parent[cell];
+        path.push_back(std::make_pair(grid.row(cell), grid.col(cell)));
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+//Searches from one cell to another, 8-connected if diagonal. Returns the padded goal cell or -1
+int searchToPoint(const PaddedGrid& grid, SearchState<int>& state, bool diagonal, int start_x, int start_y, int goal_x, int goal_y) {
+    std::vector<int> starts(1, grid.cell(start_x, start_y));
+    PointGoal goal = { grid.cell(goal_x, goal_y) };
+    if (diagonal) {
+        ChebyshevHeuristic heuristic = { goal_x, goal_y };
+        return searchGrid<EightConnected>(grid, state, starts, heuristic, goal);
+    }
+    ManhattanHeuristic heuristic = { goal_x, goal_y };
+    return searchGrid<FourConnected>(grid, state, starts, heuristic, goal);
+}
+
+//Searches from one cell to the nearest open cell of a column, 8-connected if diagonal. Returns the padded cell reached or -1
+int searchToColumn(const PaddedGrid& grid, SearchState<int>& state, bool diagonal, int start_x, int start_y, int column) {
+    std::vector<int> starts(1, grid.cell(start_x, start_y));
+    ColumnGoal goal = { column, grid.stride };
+    ColumnHeuristic heuristic = { column };
+    if (diagonal) {
+        return searchGrid<EightConnected>(grid, state, starts, heuristic, goal);
+    }
+    return searchGrid<FourConnected>(grid, state, starts, heuristic, goal);
+}
+
+struct FieldEntryPriority {
+    int operator()(const std::pair<int, int>& e) const {
+        return e.first;
+    }
+};
+
+//Cost of the cheapest path from every cell to any of seeds (padded cells), -1 where none can be reached. It runs
+//Dijkstra backwards from all the seeds at once, a step from a cell onto its neighbour costs what the forward search
+//pays, so with unit weights this is a plain multi-source BFS. Seeds in shadow cost 1 to step onto, like point goals
+template <typename Connectivity>
+std::vector<int> distanceField(const PaddedGrid& grid, const std::vector<int>& seeds) {
+    std::vector<int> field(grid.step.size(), -1);
+    BucketQueue<std::pair<int, int>, FieldEntryPriority> frontier; // (cost, cell)
+    const unsigned char* step = &grid.step[0];
+    const int s = grid.stride;
+    STAT_ADD(searches, 1);
+    for (size_t k = 0; k < seeds.size(); k++) {
+        if (field[seeds[k]] != 0) {
+            field[seeds[k]] = 0;
+            frontier.push(std::make_pair(0, seeds[k]));
+        }
+    }
+
+    while (!frontier.empty()) {
+        std::pair<int, int> current = frontier.top();
+        frontier.pop();
+        STAT_ADD(expansions, 1);
+        int c = current.second;
+        if (current.first > field[c]) {
+            STAT_ADD(stalePops, 1);
+            continue;
+        }
+        int w = std::max((int)step[c], 1);
+        int orthogonal = current.first + StepCost<int>::orthogonal(w); // Cost from a neighbour through c
+        int diagonal = current.first + StepCost<int>::diagonal(w);
+
+        auto relax = [&](int prev, int cost) {
+            if (step[prev] != 0 && (field[prev] == -1 || cost < field[prev])) {
+                field[prev] = cost;
+                frontier.push(std::make_pair(cost, prev));
+                STAT_ADD(pushes, 1);
+            }
+        };
+
+        relax(c - s, orthogonal);
+        relax(c + s, orthogonal);
+        relax(c - 1, orthogonal);
+        relax(c + 1, orthogonal);
+        if (Connectivity::diagonals) { // Same corner rule as the forward search, which is symmetric
+            bool up = step[c - s] != 0, down = step[c + s] != 0, left = step[c - 1] != 0, right = step[c + 1] != 0;
+            if (up && left) {
+                relax(c - s - 1, diagonal);
+            }
+            if (up && right) {
+                relax(c - s + 1, diagonal);
+            }
+            if (down && left) {
+                relax(c + s - 1, diagonal);
+            }
+            if (down && right) {
+                relax(c + s + 1, diagonal);
+            }
+        }
+    }
+    return field;
+}
+
+std::vector<int> distanceField(const PaddedGrid& grid, bool diagonal, const std::vector<int>& seeds) {
+    if (diagonal) {
+        return distanceField<EightConnected>(grid, seeds);
+    }
+    return distanceField<FourConnected>(grid, seeds);
+}
+
+//Open cells of a column as padded cells, to seed a distance field
+std::vector<int> columnCells(const PaddedGrid& grid, int column) {
+    std::vector<int> cells;
+    for (int i = grid.top; i < grid.bottom; i++) {
+        if (grid.step[grid.cell(i, column)] != 0) {
+            cells.push_back(grid.cell(i, column));
+        }
+    }
+    return cells;
+}
+
+//Labels the connected open cells of a grid from 1 up, blocked cells get 0. Two open cells with different labels
+//can't reach each other. Diagonals can't cut corners so 8-connectivity joins exactly the same cells as 4
+std::vector<int> labelComponents(const PaddedGrid& grid) {
+    std::vector<int> labels(grid.step.size(), 0);
+    std::vector<int> stack;
+    const int offsets[4] = { -grid.stride, grid.stride, -1, 1 };
+    int next = 1;
+    for (size_t c = 0; c < grid.step.size(); c++) {
+        if (grid.step[c] == 0 || labels[c] != 0) {
+            continue;
+        }
+        labels[c] = next;
+        stack.push_back((int)c);
+        while (!stack.empty()) {
+            int cell = stack.back();
+            stack.pop_back();
+            for (int k = 0; k < 4; k++) {
+                int n = cell + offsets[k];
+                if (grid.step[n] != 0 && labels[n] == 0) {
+                    labels[n] = next;
+                    stack.push_back(n);
+                }
+            }
+        }
+        next++;
+    }
+    return labels;
+}
+
+//Dijkstra from one cell until every goal cell (non zero in goals, padded) has been popped. remaining is the number
+//of distinct goal cells. The cost of a goal is left in state if state.reached(goal), otherwise it can't be reached
+void searchToCells(const PaddedGrid& grid, SearchState<int>& state, bool diagonal, int start_x, int start_y, const std::vector<unsigned char>& goals, int remaining) {
+    std::vector<int> starts(1, grid.cell(start_x, start_y));
+    MultiPointGoal goal = { &goals[0], &remaining };
+    if (diagonal) {
+        searchGrid<EightConnected>(grid, state, starts, NoHeuristic(), goal);
+    } else {
+        searchGrid<FourConnected>(grid, state, starts, NoHeuristic(), goal);
+    }
+}
+
+//Searches from one cell to the nearest seed of a distance field built with the same connectivity. The field is an
+//exact heuristic, so only cells on a cheapest path get expanded. Returns the seed reached or -1
+int searchToField(const PaddedGrid& grid, SearchState<int>& state, bool diagonal, const std::vector<int>& field, int start_x, int start_y) {
+    std::vector<int> starts(1, grid.cell(start_x, start_y));
+    FieldGoal goal = { &field[0] };
+    FieldHeuristic heuristic = { &field[0], grid.stride, grid.top };
+    if (diagonal) {
+        return searchGrid<EightConnected>(grid, state, starts, heuristic, goal);
+    }
+    return searchGrid<FourConnected>(grid, state, starts, heuristic, goal);
+}
+
+#endif
@@ -0,0 +1,562 @@
+/* Running From The Night:
+Skeleton graph of a grid for repeated leg queries: corridors are contracted into weighted edges between junctions and
+open rectangles keep only their sides, so a leg is an A* over the skeleton's nodes instead of A* over every cell */
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <utility>
+#include "search_kernel.h"
+#include "stats.h"
+
+// Every open cell is one of
+//  - a node: a junction, a dead end, the side of a rectangle or anything else without exactly two moves
+//  - a chain cell: part of a run of cells with exactly two moves (a corridor) between two nodes. A shortest path can
+//    only cross a chain end to end, so the chain becomes one edge each way
+//  - the inside of a rectangle: for 4-connectivity, open areas of one weight are cut into rectangles of at least 3 x 3
+//    cells. Their insides are dropped and every side cell gets an edge straight across to the opposite side. A
+//    shortest path through a rectangle can always be straightened into one that crosses it in a line and runs along
+//    its sides, so no cost changes (rectangular symmetry reduction, Harabor, Botea and Kilby 2011)
+// Costs are what the kernel pays to step onto each cell, so an edge and its reverse can differ when cells are weighted
+struct SkeletonGraph {
+    struct Edge {
+        int to; // Node
+        int cost;
+        int chain; // -1 for a straight line of cells (a neighbour, or across a rectangle)
+        bool forward; // Along the chain's cells in order
+    };
+
+    // Rectangles are inclusive cell ranges, unpadded
+    struct Rect {
+        int x0, y0, x1, y1;
+        int weight;
+    };
+
+    bool diagonal; // Built for 8-connectivity
+    std::vector<int> nodeCell; // Padded cell of each node
+    std::vector<int> nodeRow, nodeCol; // Unpadded coordinates of each node, for the heuristic
+    std::vector<int> nodeOf; // Node of each padded cell, -1 if it isn't one
+    std::vector<int> edgeBegin; // Edges of node n are edges[edgeBegin[n]] to edges[edgeBegin[n + 1]]
+    std::vector<Edge> edges;
+    std::vector<int> chainFrom, chainTo; // End nodes, the chain's cells run from chainFrom to chainTo
+    std::vector<int> chainForward; // Cost from chainFrom to chainTo
+    std::vector<int> chainBackward; // Cost from chainTo to chainFrom
+    std::vector<int> chainBegin; // Cells of chain k are slots chainBegin[k] to chainBegin[k + 1]
+    std::vector<int> slotCell; // Padded cell of each chain slot
+    std::vector<int> slotForward; // Cost from chainFrom to the slot's cell
+    std::vector<int> slotBackward; // Cost from chainTo to the slot's cell
+    std::vector<int> slotChain;
+    std::vector<int> slotOf; // Chain slot of each padded cell, -1 if it isn't on a chain
+    std::vector<Rect> rects;
+    std::vector<int> rectOf; // Rectangle of each padded cell (side or inside), -1 if it isn't in one
+
+    int numNodes() const {
+        return (int)nodeCell.size();
+    }
+
+    //Node an edge leaves from
+    int edgeSource(int e) const {
+        return (int)(std::upper_bound(edgeBegin.begin(), edgeBegin.end(), e) - edgeBegin.begin()) - 1;
+    }
+
+    //True for the cells inside a rectangle, which aren't in the graph
+    bool inside(const PaddedGrid& grid, int cell) const {
+        int r = rectOf[cell];
+        if (r == -1) {
+            return false;
+        }
+        int x = grid.row(cell), y = grid.col(cell);
+        return x > rects[r].x0 && x < rects[r].x1 && y > rects[r].y0 && y < rects[r].y1;
+    }
+};
+
+//The moves out of cell c (padded) the kernel would make, with what each costs, leaving out cells inside rectangles.
+//Diagonals can't cut corners
+template <typename Connectivity>
+int skeletonMoves(const PaddedGrid& grid, const SkeletonGraph& g, int c, int* next, int* cost) {
+    const unsigned char* step = &grid.step[0];
+    const int s = grid.stride;
+    int n = 0;
+    const int orthogonal[4] = { -s, s, -1, 1 };
+    for (int k = 0; k < 4; k++) {
+        if (step[c + orthogonal[k]] != 0 && !g.inside(grid, c + orthogonal[k])) {
+            next[n] = c + orthogonal[k];
+            cost[n++] = StepCost<int>::orthogonal(step[c + orthogonal[k]]);
+        }
+    }
+    if (Connectivity::diagonals) {
+        bool up = step[c - s] != 0, down = step[c + s] != 0, left = step[c - 1] != 0, right = step[c + 1] != 0;
+        const int corners[4] = { -s - 1, -s + 1, s - 1, s + 1 };
+        const bool allowed[4] = { up && left, up && right, down && left, down && right };
+        for (int k = 0; k < 4; k++) {
+            if (allowed[k] && step[c + corners[k]] != 0) {
+                next[n] = c + corners[k];
+                cost[n++] = StepCost<int>::diagonal(step[c + corners[k]]);
+            }
+        }
+    }
+    return n;
+}
+
+//Cuts the open cells into rectangles of one weight, each the biggest (by area) with its top left at the first cell
+//not in one yet. Rectangles thinner than 3 cells have no inside and are left out
+void findRectangles(const PaddedGrid& grid, SkeletonGraph& g) {
+    for (int i = grid.top; i < grid.bottom; i++) {
+        for (int j = 0; j < grid.width; j++) {
+            int c = grid.cell(i, j);
+            int w = grid.step[c];
+            if (w == 0 || g.rectOf[c] != -1) {
+                continue;
+            }
+            SkeletonGraph::Rect best = { i, j, i, j, w };
+            long long bestArea = 0;
+            int width = INT_MAX;
+            for (int x = i; x < grid.bottom; x++) {
+                int run = 0;
+                for (int y = j; y < grid.width && run < width; y++, run++) {
+                    int cell = grid.cell(x, y);
+                    if (grid.step[cell] != w || g.rectOf[cell] != -1) {
+                        break;
+                    }
+                }
+                width = std::min(width, run);
+                if (width < 3) {
+                    break;
+                }
+                long long area = (long long)width * (x - i + 1);
+                if (x - i >= 2 && area > bestArea) {
+                    bestArea = area;
+                    best.x1 = x;
+                    best.y1 = j + width - 1;
+                }
+            }
+            if (bestArea == 0) {
+                continue;
+            }
+            int r = (int)g.rects.size();
+            g.rects.push_back(best);
+            for (int x = best.x0; x <= best.x1; x++) {
+                for (int y = best.y0; y <= best.y1; y++) {
+                    g.rectOf[grid.cell(x, y)] = r;
+                }
+            }
+        }
+    }
+}
+
+template <typename Connectivity>
+SkeletonGraph buildSkeleton(const PaddedGrid& grid) {
+    TRACE_SCOPE("buildSkeleton");
+    SkeletonGraph g;
+    g.diagonal = Connectivity::diagonals;
+    size_t cells = grid.step.size();
+    g.nodeOf.assign(cells, -1);
+    g.slotOf.assign(cells, -1);
+    g.rectOf.assign(cells, -1);
+    if (!Connectivity::diagonals) { // Diagonal steps cut across rectangles, so they only pay off for 4-connectivity
+        findRectangles(grid, g);
+    }
+    int next[8], cost[8];
+    for (int i = grid.top; i < grid.bottom; i++) {
+        for (int j = 0; j < grid.width; j++) {
+            int c = grid.cell(i, j);
+            if (grid.step[c] != 0 && !g.inside(grid, c) && (g.rectOf[c] != -1 || skeletonMoves<Connectivity>(grid, g, c, next, cost) != 2)) {
+                g.nodeOf[c] = (int)g.nodeCell.size();
+                g.nodeCell.push_back(c);
+            }
+        }
+    }
+
+    std::vector<std::vector<SkeletonGraph::Edge> > out;
+    // Walks the chain that leaves node u through its move to first, adding it (and its two edges) unless it is known
+    auto walk = [&](int u, int first, int firstCost) {
+        if (g.nodeOf[first] != -1) { // Neighbouring nodes, each adds its own way out
+            SkeletonGraph::Edge e = { g.nodeOf[first], firstCost, -1, true };
+            out[u].push_back(e);
+            return;
+        }
+        if (g.slotOf[first] != -1) { // Walked from its other end already
+            return;
+        }
+        int chain = (int)g.chainFrom.size();
+        g.chainFrom.push_back(u);
+        g.chainBegin.push_back((int)g.slotCell.size());
+        int prev = g.nodeCell[u];
+        int c = first;
+        int forward = firstCost;
+        while (g.nodeOf[c] == -1) { // Every cell off the nodes has exactly two moves, back and on
+            g.slotOf[c] = (int)g.slotCell.size();
+            g.slotCell.push_back(c);
+            g.slotForward.push_back(forward);
+            g.slotChain.push_back(chain);
+            skeletonMoves<Connectivity>(grid, g, c, next, cost);
+            int k = next[0] == prev ? 1 : 0;
+            prev = c;
+            c = next[k];
+            forward += cost[k];
+        }
+        int v = g.nodeOf[c];
+        g.chainTo.push_back(v);
+        int firstSlot = g.chainBegin.back();
+        int lastSlot = (int)g.slotCell.size() - 1;
+        // Walking back from v every step costs what stepping onto the cell it lands on costs, the last one lands on u
+        int b = 0;
+        for (int k = lastSlot; k >= firstSlot; k--) {
+            int from = k == lastSlot ? g.nodeCell[v] : g.slotCell[k + 1];
+            bool diagonalStep = grid.row(from) != grid.row(g.slotCell[k]) && grid.col(from) != grid.col(g.slotCell[k]);
+            int w = grid.step[g.slotCell[k]];
+            b += diagonalStep ? StepCost<int>::diagonal(w) : StepCost<int>::orthogonal(w);
+            g.slotBackward.push_back(b);
+        }
+        std::reverse(g.slotBackward.begin() + firstSlot, g.slotBackward.end());
+        bool lastDiagonal = grid.row(g.slotCell[firstSlot]) != grid.row(g.nodeCell[u]) && grid.col(g.slotCell[firstSlot]) != grid.col(g.nodeCell[u]);
+        int w = grid.step[g.nodeCell[u]];
+        int backward = b + (lastDiagonal ? StepCost<int>::diagonal(w) : StepCost<int>::orthogonal(w));
+        g.chainForward.push_back(forward);
+        g.chainBackward.push_back(backward);
+        if (u != v) { // A chain back to its own node is never worth walking
+            SkeletonGraph::Edge there = { v, forward, chain, true };
+            SkeletonGraph::Edge back = { u, backward, chain, false };
+            out[u].push_back(there);
+            out[v].push_back(back);
+        }
+    };
+    auto walkAll = [&](int u) {
+        int m = skeletonMoves<Connectivity>(grid, g, g.nodeCell[u], next, cost);
+        int moveNext[8], moveCost[8]; // walk overwrites next and cost
+        std::copy(next, next + m, moveNext);
+        std::copy(cost, cost + m, moveCost);
+        for (int k = 0; k < m; k++) {
+            walk(u, moveNext[k], moveCost[k]);
+        }
+    };
+
+    out.resize(g.nodeCell.size());
+    for (int u = 0; u < (int)g.nodeCell.size(); u++) {
+        walkAll(u);
+    }
+    for (int i = grid.top; i < grid.bottom; i++) { // Cycles of two move cells with no node on them, one cell becomes the node
+        for (int j = 0; j < grid.width; j++) {
+            int c = grid.cell(i, j);
+            if (grid.step[c] != 0 && !g.inside(grid, c) && g.nodeOf[c] == -1 && g.slotOf[c] == -1) {
+                g.nodeOf[c] = (int)g.nodeCell.size();
+                g.nodeCell.push_back(c);
+                out.resize(g.nodeCell.size());
+                walkAll(g.nodeOf[c]);
+            }
+        }
+    }
+    for (size_t r = 0; r < g.rects.size(); r++) { // Straight across every rectangle from each side cell that isn't a corner
+        const SkeletonGraph::Rect& rect = g.rects[r];
+        for (int y = rect.y0 + 1; y < rect.y1; y++) {
+            int top = g.nodeOf[grid.cell(rect.x0, y)], bottom = g.nodeOf[grid.cell(rect.x1, y)];
+            SkeletonGraph::Edge down = { bottom, (rect.x1 - rect.x0) * rect.weight, -1, true };
+            SkeletonGraph::Edge up = { top, (rect.x1 - rect.x0) * rect.weight, -1, true };
+            out[top].push_back(down);
+            out[bottom].push_back(up);
+        }
+        for (int x = rect.x0 + 1; x < rect.x1; x++) {
+            int left = g.nodeOf[grid.cell(x, rect.y0)], right = g.nodeOf[grid.cell(x, rect.y1)];
+            SkeletonGraph::Edge east = { right, (rect.y1 - rect.y0) * rect.weight, -1, true };
+            SkeletonGraph::Edge west = { left, (rect.y1 - rect.y0) * rect.weight, -1, true };
+            out[left].push_back(east);
+            out[right].push_back(west);
+        }
+    }
+    g.chainBegin.push_back((int)g.slotCell.size());
+    for (size_t n = 0; n < g.nodeCell.size(); n++) {
+        g.nodeRow.push_back(grid.row(g.nodeCell[n]));
+        g.nodeCol.push_back(grid.col(g.nodeCell[n]));
+    }
+    g.edgeBegin.assign(1, 0);
+    for (size_t u = 0; u < out.size(); u++) {
+        g.edges.insert(g.edges.end(), out[u].begin(), out[u].end());
+        g.edgeBegin.push_back((int)g.edges.size());
+    }
+    return g;
+}
+
+SkeletonGraph buildSkeleton(const PaddedGrid& grid, bool diagonal) {
+    if (diagonal) {
+        return buildSkeleton<EightConnected>(grid);
+    }
+    return buildSkeleton<FourConnected>(grid);
+}
+
+// Where a query cell joins the graph: up to four nodes, each with the cost between the cell and the node
+struct SkeletonAnchor {
+    int count;
+    int node[4];
+    int cost[4];
+};
+
+//Anchors an open cell (padded). leaving is true for a start (cost from the cell to the node), false for a goal
+SkeletonAnchor skeletonAnchor(const SkeletonGraph& g, const PaddedGrid& grid, int cell, bool leaving) {
+    SkeletonAnchor a;
+    a.count = 0;
+    if (g.nodeOf[cell] != -1) {
+        a.node[a.count] = g.nodeOf[cell];
+        a.cost[a.count++] = 0;
+    } else if (g.slotOf[cell] != -1) {
+        int slot = g.slotOf[cell];
+        int chain = g.slotChain[slot];
+        if (leaving) { // Out through chainTo going forward, out through chainFrom going backward
+            a.node[a.count] = g.chainTo[chain];
+            a.cost[a.count++] = g.chainForward[chain] - g.slotForward[slot];
+            a.node[a.count] = g.chainFrom[chain];
+            a.cost[a.count++] = g.chainBackward[chain] - g.slotBackward[slot];
+        } else {
+            a.node[a.count] = g.chainFrom[chain];
+            a.cost[a.count++] = g.slotForward[slot];
+            a.node[a.count] = g.chainTo[chain];
+            a.cost[a.count++] = g.slotBackward[slot];
+        }
+    } else { // Inside a rectangle, straight out to each side costs the same both ways
+        const SkeletonGraph::Rect& rect = g.rects[g.rectOf[cell]];
+        int x = grid.row(cell), y = grid.col(cell);
+        const int sides[4][2] = { { rect.x0, y }, { rect.x1, y }, { x, rect.y0 }, { x, rect.y1 } };
+        for (int k = 0; k < 4; k++) {
+            a.node[a.count] = g.nodeOf[grid.cell(sides[k][0], sides[k][1])];
+            a.cost[a.count++] = (std::abs(sides[k][0] - x) + std::abs(sides[k][1] - y)) * rect.weight;
+        }
+    }
+    return a;
+}
+
+//Cost of a path between two cells that doesn't need the graph: straight along the chain they are both on, or
+//through the rectangle they are both in. -1 if they share neither
+int skeletonDirect(const SkeletonGraph& g, const PaddedGrid& grid, int from, int to) {
+    int a = g.slotOf[from], b = g.slotOf[to];
+    if (a != -1 && b != -1 && g.slotChain[a] == g.slotChain[b]) {
+        return a <= b ? g.slotForward[b] - g.slotForward[a] : g.slotBackward[b] - g.slotBackward[a];
+    }
+    if (g.rectOf[from] != -1 && g.rectOf[from] == g.rectOf[to]) {
+        return (std::abs(grid.row(from) - grid.row(to)) + std::abs(grid.col(from) - grid.col(to))) * g.rects[g.rectOf[from]].weight;
+    }
+    return -1;
+}
+
+//Lower bound on the cost from a node to the cell at (x, y), what the kernel's heuristic would say about the node's cell
+inline int skeletonEstimate(const SkeletonGraph& g, int node, int x, int y) {
+    if (g.diagonal) {
+        ChebyshevHeuristic heuristic = { x, y };
+        return heuristic.estimate<int>(g.nodeRow[node], g.nodeCol[node]);
+    }
+    ManhattanHeuristic heuristic = { x, y };
+    return heuristic.estimate<int>(g.nodeRow[node], g.nodeCol[node]);
+}
+
+//A* over the graph between two open cells (padded). Returns the cost, -1 if there's no path. The node
+//reached last is left in state (parents are edge indices, -1 at a start node) and in goalNode, -1 if the cheapest
+//way didn't need the graph (see skeletonDirect) or the cells are the same
+int skeletonSearch(const SkeletonGraph& g, const PaddedGrid& grid, SearchState<int>& state, int from, int to, int& goalNode) {
+    goalNode = -1;
+    if (from == to) {
+        return 0;
+    }
+    int best = skeletonDirect(g, grid, from, to);
+    if (best == -1) {
+        best = INT_MAX;
+    }
+    SkeletonAnchor start = skeletonAnchor(g, grid, from, true);
+    SkeletonAnchor goal = skeletonAnchor(g, grid, to, false);
+    int goalX = grid.row(to), goalY = grid.col(to);
+    typedef KernelEntry<int> Entry; // Same order as the kernel, ties go to the deeper node
+    KernelFrontier<int>::type frontier;
+    state.begin(g.nodeCell.size());
+    STAT_ADD(searches, 1);
+    for (int k = 0; k < start.count; k++) {
+        int n = start.node[k];
+        if (!state.reached(n) || start.cost[k] < state.cost[n]) {
+            state.stamp[n] = state.epoch;
+            state.cost[n] = start.cost[k];
+            state.parent[n] = -1;
+            Entry e = { start.cost[k] + skeletonEstimate(g, n, goalX, goalY), start.cost[k], n };
+            frontier.push(e);
+            STAT_ADD(pushes, 1);
+        }
+    }
+    while (!frontier.empty() && frontier.top().priority < best) {
+        Entry current = frontier.top();
+        frontier.pop();
+        STAT_ADD(expansions, 1);
+        int u = current.cell;
+        if (current.cost > state.cost[u]) {
+            STAT_ADD(stalePops, 1);
+            continue;
+        }
+        for (int k = 0; k < goal.count; k++) {
+            if (goal.node[k] == u && current.cost + goal.cost[k] < best) {
+                best = current.cost + goal.cost[k];
+                goalNode = u;
+            }
+        }
+        for (int e = g.edgeBegin[u]; e < g.edgeBegin[u + 1]; e++) {
+            int v = g.edges[e].to;
+            int cost = current.cost + g.edges[e].cost;
+            if (!state.reached(v) || cost < state.cost[v]) {
+                state.stamp[v] = state.epoch;
+                state.cost[v] = cost;
+                state.parent[v] = e;
+                Entry next = { cost + skeletonEstimate(g, v, goalX, goalY), cost, v };
+                frontier.push(next);
+                STAT_ADD(pushes, 1);
+            }
+        }
+    }
+    if (best == INT_MAX) {
+        STAT_ADD(failedSearches, 1);
+        return -1;
+    }
+    return best;
+}
+
+//Appends the cells of a chain between two of its slots, first excluded and last included, in walking order
+void appendChainCells(const SkeletonGraph& g, int firstSlot, int lastSlot, std::vector<int>& cells) {
+    if (firstSlot <= lastSlot) {
+        for (int k = firstSlot + 1; k <= lastSlot; k++) {
+            cells.push_back(g.slotCell[k]);
+        }
+    } else {
+        for (int k = firstSlot - 1; k >= lastSlot; k--) {
+            cells.push_back(g.slotCell[k]);
+        }
+    }
+}
+
+//Appends the cells of the straight line from one cell to another (in a row, a column or one diagonal step), from
+//excluded and to included
+void appendLine(const PaddedGrid& grid, int from, int to, std::vector<int>& cells) {
+    int dx = grid.row(to) - grid.row(from), dy = grid.col(to) - grid.col(from);
+    int step = (dx > 0) - (dx < 0);
+    step = step * grid.stride + (dy > 0) - (dy < 0);
+    for (int c = from; c != to; ) {
+        c += step;
+        cells.push_back(c);
+    }
+}
+
+//Appends the cells between a query cell and the node it joined the graph at, in walking order. leaving is true
+//when walking from the cell to the node
+void appendAnchorCells(const SkeletonGraph& g, const PaddedGrid& grid, int cell, int node, bool leaving, std::vector<int>& cells) {
+    if (g.nodeOf[cell] != -1) {
+        return;
+    }
+    int slot = g.slotOf[cell];
+    if (slot == -1) { // Inside a rectangle, straight out
+        if (leaving) {
+            appendLine(grid, cell, g.nodeCell[node], cells);
+        } else {
+            appendLine(grid, g.nodeCell[node], cell, cells);
+        }
+        return;
+    }
+    int chain = g.slotChain[slot];
+    int first = g.chainBegin[chain], last = g.chainBegin[chain + 1] - 1;
+    if (leaving) { // Forward to chainTo unless chainFrom is the node (or both are and backward is cheaper)
+        bool forward = g.chainTo[chain] == node && !(g.chainFrom[chain] == node
+                && g.chainForward[chain] - g.slotForward[slot] > g.chainBackward[chain] - g.slotBackward[slot]);
+        appendChainCells(g, slot, forward ? last : first, cells);
+        cells.push_back(g.nodeCell[node]);
+    } else {
+        bool forward = g.chainFrom[chain] == node && !(g.chainTo[chain] == node && g.slotForward[slot] > g.slotBackward[slot]);
+        appendChainCells(g, forward ? first - 1 : last + 1, slot, cells);
+    }
+}
+
+//Expands the cheapest path between two open cells back into grid cells, start first in unpadded coordinates.
+//Empty if there's no path
+std::vector<std::pair<int, int> > skeletonPath(const SkeletonGraph& g, const PaddedGrid& grid, SearchState<int>& state, int from, int to) {
+    int goalNode;
+    if (skeletonSearch(g, grid, state, from, to, goalNode) == -1) {
+        return std::vector<std::pair<int, int> >();
+    }
+    std::vector<int> cells(1, from);
+    if (goalNode == -1 && from != to) { // Along one chain, or through one rectangle down then across
+        if (g.slotOf[from] != -1 && g.slotOf[to] != -1 && g.slotChain[g.slotOf[from]] == g.slotChain[g.slotOf[to]]) {
+            appendChainCells(g, g.slotOf[from], g.slotOf[to], cells);
+        } else {
+            int corner = grid.cell(grid.row(to), grid.col(from));
+            appendLine(grid, from, corner, cells);
+            appendLine(grid, corner, to, cells);
+        }
+    } else if (goalNode != -1) {
+        std::vector<int> route; // Edges from the start node to goalNode
+        int startNode = goalNode;
+        while (state.parent[startNode] != -1) {
+            route.push_back(state.parent[startNode]);
+            startNode = g.edgeSource(state.parent[startNode]);
+        }
+        std::reverse(route.begin(), route.end());
+        appendAnchorCells(g, grid, from, startNode, true, cells);
+        for (size_t r = 0; r < route.size(); r++) {
+            const SkeletonGraph::Edge& e = g.edges[route[r]];
+            if (e.chain == -1) {
+                appendLine(grid, cells.back(), g.nodeCell[e.to], cells);
+            } else {
+                int first = g.chainBegin[e.chain], last = g.chainBegin[e.chain + 1] - 1;
+                appendChainCells(g, e.forward ? first - 1 : last + 1, e.forward ? last : first, cells);
+                cells.push_back(g.nodeCell[e.to]);
+            }
+        }
+        appendAnchorCells(g, grid, to, goalNode, false, cells);
+    }
+    std::vector<std::pair<int, int> > path;
+    for (size_t k = 0; k < cells.size(); k++) {
+        path.push_back(std::make_pair(grid.row(cells[k]), grid.col(cells[k])));
+    }
+    return path;
+}
+
+// A skeleton with the scratch its searches reuse
+struct SkeletonRouter {
+    SkeletonGraph graph;
+    SearchState<int> search;
+};
+
+//Cost of the cheapest path between two cells of the grid the skeleton was built from, the same as the kernel's.
+//-1 if there's no path, -2 if either cell is blocked (a goal in shadow), those are left to the kernel
+int skeletonLeg(SkeletonRouter& router, const PaddedGrid& grid, int start_x, int start_y, int goal_x, int goal_y) {
+    TRACE_SCOPE("skeletonLeg");
+    int from = grid.cell(start_x, start_y);
+    int to = grid.cell(goal_x, goal_y);
+    if (grid.step[from] == 0 || grid.step[to] == 0) {
+        return -2;
+    }
+    int goalNode;
+    return skeletonSearch(router.graph, grid, router.search, from, to, goalNode);
+}
+
+// Past this share of the open cells as nodes, a leg on the skeleton visits about as many nodes as it would cells on
+// the grid and is no faster, each node has more edges to look at and the leg has to be anchored first. With d no
+// cell has exactly two moves and there are no rectangles, so every open cell is a node. With w few corridors and
+// rectangles keep one weight
+const double MAX_SKELETON_NODE_SHARE = 0.5;
+
+//Number of open cells of a grid
+size_t openCells(const PaddedGrid& grid) {
+    size_t open = 0;
+    for (size_t c = 0; c < grid.step.size(); c++) {
+        open += grid.step[c] != 0;
+    }
+    return open;
+}
+
+//True if the skeleton is enough smaller than its grid to search instead of it, see MAX_SKELETON_NODE_SHARE
+bool skeletonPaysOff(const SkeletonGraph& g, const PaddedGrid& grid) {
+    return g.numNodes() <= MAX_SKELETON_NODE_SHARE * openCells(grid);
+}
+
+//Prints the size of a skeleton next to the open cells it stands for, and whether it is searched
+void reportSkeleton(const SkeletonGraph& g, const PaddedGrid& grid, int world_rank) {
+    size_t open = openCells(grid);
+    printf("Rank %d skeleton: %d nodes, %zu edges, %zu corridors, %zu rectangles for %zu open cells (%.1f%% of them nodes)%s \n", world_rank, g.numNodes(),
+            g.edges.size(), g.chainFrom.size(), g.rects.size(), open, open == 0 ? 0.0 : 100.0 * g.nodeCell.size() / open,
+            skeletonPaysOff(g, grid) ? "" : ", searching the grid instead");
+}
+
+#endif
@@ -0,0 +1,171 @@
+/* Running From The Night:
+Hot path counters and timelines, compiled in with -DMAGELLAN_STATS (make STATS=1) and free otherwise */
+#ifndef STATS_H
+#define STATS_H
+
+#include <mpi.h>
+
+// Counters are plain per thread globals. The viewshed threads don't touch them, batch query workers hand theirs
+// over with statsFlushThread before they exit
+#ifdef MAGELLAN_STATS
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+const bool STATS_COMPILED_IN = true;
+
+struct SearchStats {
+    long long searches; // Calls into one of the A* variants
+    long long expansions; // Nodes popped and expanded
+    long long pushes; // Nodes pushed on a frontier
+    long long stalePops; // Popped nodes whose cost had already been improved
+    long long failedSearches; // Searches that never reached their goal
+    long long candidatesScanned; // Cells checked by the antenna scans
+};
+
+enum MpiCall { MPI_CALL_SEND, MPI_CALL_RECV, MPI_CALL_BCAST, MPI_CALL_BARRIER, MPI_CALL_ALLREDUCE, MPI_CALL_REDUCE, MPI_CALL_FETCH_AND_OP,
+        MPI_CALL_COMM_SPLIT_TYPE, MPI_CALL_COMM_FREE, MPI_CALL_WIN_ALLOCATE, MPI_CALL_WIN_ALLOCATE_SHARED, MPI_CALL_WIN_FENCE, MPI_CALL_WIN_LOCK,
+        MPI_CALL_WIN_UNLOCK, MPI_CALL_WIN_LOCK_ALL, MPI_CALL_WIN_UNLOCK_ALL, MPI_CALL_WIN_FREE, NUM_MPI_CALLS };
+const char* MPI_CALL_NAMES[NUM_MPI_CALLS] = { "MPI_Send", "MPI_Recv", "MPI_Bcast", "MPI_Barrier", "MPI_Allreduce", "MPI_Reduce", "MPI_Fetch_and_op",
+        "MPI_Comm_split_type", "MPI_Comm_free", "MPI_Win_allocate", "MPI_Win_allocate_shared", "MPI_Win_fence", "MPI_Win_lock",
+        "MPI_Win_unlock", "MPI_Win_lock_all", "MPI_Win_unlock_all", "MPI_Win_free" };
+
+struct TraceEvent {
+    const char* name;
+    double start, duration; // Seconds since MPI_Init
+};
+
+thread_local SearchStats g_searchStats = { 0, 0, 0, 0, 0, 0 };
+SearchStats g_workerStats = { 0, 0, 0, 0, 0, 0 }; // Flushed by worker threads, added in by statsReport
+std::mutex g_workerStatsMutex;
+long long g_mpiCalls[NUM_MPI_CALLS] = { 0 };
+double g_mpiSeconds[NUM_MPI_CALLS] = { 0 };
+std::vector<TraceEvent> g_trace;
+bool g_tracing = false;
+const size_t MAX_TRACE_EVENTS = 1000000; // Stop recording rather than run out of memory on huge runs
+double g_traceOrigin = 0;
+
+void traceEvent(const char* name, double start, double end) {
+    if (g_tracing && g_trace.size() < MAX_TRACE_EVENTS) {
+        TraceEvent e = { name, start - g_traceOrigin, end - start };
+        g_trace.push_back(e);
+    }
+}
+
+void statsRecordMpi(MpiCall call, double start, double end) {
+    g_mpiCalls[call]++;
+    g_mpiSeconds[call] += end - start;
+    traceEvent(MPI_CALL_NAMES[call], start, end);
+}
+
+// Records the lifetime of the scope as one timeline event
+class TraceScope {
+public:
+    TraceScope(const char* name) : name(name), start(MPI_Wtime()) {}
+    ~TraceScope() {
+        traceEvent(name, start, MPI_Wtime());
+    }
+private:
+    const char* name;
+    double start;
+};
+
+void statsStart(bool tracing) {
+    g_tracing = tracing;
+    g_traceOrigin = MPI_Wtime();
+}
+
+//Adds the calling thread's counters to the rank's, for threads other than the main one before they exit
+void statsFlushThread() {
+    std::lock_guard<std::mutex> lock(g_workerStatsMutex);
+    g_workerStats.searches += g_searchStats.searches;
+    g_workerStats.expansions += g_searchStats.expansions;
+    g_workerStats.pushes += g_searchStats.pushes;
+    g_workerStats.stalePops += g_searchStats.stalePops;
+    g_workerStats.failedSearches += g_searchStats.failedSearches;
+    g_workerStats.candidatesScanned += g_searchStats.candidatesScanned;
+    g_searchStats = SearchStats();
+}
+
+//Reduces the counters over every rank and has rank 0 write them as JSON to statsPath. With tracing on,
+//every rank also writes its timeline as a Chrome trace to <tracePrefix><rank>.json
+void statsReport(int world_rank, int world_size, const char* statsPath, const char* tracePrefix) {
+    const int numCounters = 6;
+    statsFlushThread();
+    SearchStats total = g_workerStats; // Every thread of the rank
+    long long local[numCounters] = { total.searches, total.expansions, total.pushes, total.stalePops,
+            total.failedSearches, total.candidatesScanned };
+    const char* names[numCounters] = { "searches", "expansions", "pushes", "stale_pops", "failed_searches", "candidates_scanned" };
+    long long sum[numCounters], max[numCounters];
+    long long mpiCallsSum[NUM_MPI_CALLS];
+    double mpiSecondsSum[NUM_MPI_CALLS], mpiSecondsMax[NUM_MPI_CALLS];
+    MPI_Reduce(local, sum, numCounters, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local, max, numCounters, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(g_mpiCalls, mpiCallsSum, NUM_MPI_CALLS, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(g_mpiSeconds, mpiSecondsSum, NUM_MPI_CALLS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(g_mpiSeconds, mpiSecondsMax, NUM_MPI_CALLS, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (world_rank == 0 && statsPath != NULL) {
+        FILE* f = fopen(statsPath, "w");
+        if (f != NULL) {
+            fprintf(f, "{\n\"ranks\": %d,\n\"search\": {\n", world_size);
+            for (int c = 0; c < numCounters; c++) {
+                fprintf(f, "  \"%s\": {\"sum\": %lld, \"max_rank\": %lld, \"avg_rank\": %.1f},\n", names[c], sum[c], max[c], (double)sum[c] / world_size);
+            }
+            fprintf(f, "  \"expansions_per_search\": %.1f\n},\n\"mpi\": {\n", sum[0] > 0 ? (double)sum[1] / sum[0] : 0.0);
+            for (int c = 0; c < NUM_MPI_CALLS; c++) {
+                fprintf(f, "  \"%s\": {\"calls\": %lld, \"seconds_sum\": %.6f, \"seconds_max_rank\": %.6f}%s\n", MPI_CALL_NAMES[c], mpiCallsSum[c],
+                        mpiSecondsSum[c], mpiSecondsMax[c], c + 1 < NUM_MPI_CALLS ? "," : "");
+            }
+            fprintf(f, "}\n}\n");
+            fclose(f);
+        } else {
+            printf("Could not write %s \n", statsPath);
+        }
+    }
+
+    if (g_tracing && tracePrefix != NULL) {
+        std::string path = std::string(tracePrefix) + std::to_string(world_rank) + ".json";
+        FILE* f = fopen(path.c_str(), "w");
+        if (f != NULL) {
+            fprintf(f, "{\"traceEvents\": [\n");
+            for (size_t e = 0; e < g_trace.size(); e++) { // Complete events, microseconds
+                fprintf(f, "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": 0}%s\n", g_trace[e].name,
+                        g_trace[e].start * 1e6, g_trace[e].duration * 1e6, world_rank, e + 1 < g_trace.size() ? "," : "");
+            }
+            fprintf(f, "]}\n");
+            fclose(f);
+        }
+    }
+}
+
+#define STAT_ADD(field, n) (g_searchStats.field += (n))
+#define STAT_MPI(call, expr) do { double statStart = MPI_Wtime(); expr; statsRecordMpi(call, statStart, MPI_Wtime()); } while (0)
+#define TRACE_SCOPE_CAT(a, b) a##b
+#define TRACE_SCOPE_NAME(line) TRACE_SCOPE_CAT(traceScope, line)
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_NAME(__LINE__)(name)
+
+#else
+
+const bool STATS_COMPILED_IN = false;
+
+#define STAT_ADD(field, n) ((void)0)
+#define STAT_MPI(call, expr) do { expr; } while (0)
+#define TRACE_SCOPE(name) ((void)0)
+
+void statsStart(bool tracing) {
+    (void)tracing;
+}
+void statsFlushThread() {}
+void statsReport(int world_rank, int world_size, const char* statsPath, const char* tracePrefix) {
+    (void)world_rank;
+    (void)world_size;
+    (void)statsPath;
+    (void)tracePrefix;
+}
+
+#endif
+
+#endif
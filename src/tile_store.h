@@ -0,0 +1,616 @@
+/* Running From The Night:
+The full resolution map as compressed bit packed tiles on disk, paged in through an LRU cache with a prefetch thread */
+#ifndef TILE_STORE_H
+#define TILE_STORE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#include "pyramid.h"
+#include "map_io.h"
+#include "stats.h"
+
+// Layout: 8 byte magic, int32 height, int32 width, int32 tileSize, int32 0, then uint64 offsets[numTiles + 1]
+// (tile t is bytes offsets[t] to offsets[t + 1] of the file), then the tiles row major. A tile is tileSize x
+// tileSize lit bits (1 lit, cells past the edge of the map 0) packed row by row lowest bit first, run length coded:
+// a control byte c < 128 is followed by c + 1 literal bytes, c >= 128 by one byte that repeats c - 125 times
+const char TILES_MAGIC[8] = { 'M', 'G', 'T', 'I', 'L', 'E', 'S', '1' };
+const int DEFAULT_TILE_SIZE = 256; // 8 KB of bits, a multiple of every level's factor
+const int TILE_PREFETCH_DEPTH = 4; // Tiles read ahead of the one being used
+
+std::vector<unsigned char> compressTile(const std::vector<unsigned char>& bits) {
+    std::vector<unsigned char> out;
+    size_t n = bits.size();
+    for (size_t i = 0; i < n; ) {
+        size_t run = 1;
+        while (i + run < n && run < 130 && bits[i + run] == bits[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            out.push_back((unsigned char)(run + 125));
+            out.push_back(bits[i]);
+            i += run;
+            continue;
+        }
+        size_t start = i; // Literals up to the next run of 3
+        while (i < n && i - start < 128 && !(i + 2 < n && bits[i] == bits[i + 1] && bits[i] == bits[i + 2])) {
+            i++;
+        }
+        out.push_back((unsigned char)(i - start - 1));
+        out.insert(out.end(), bits.begin() + start, bits.begin() + i);
+    }
+    return out;
+}
+
+//Undoes compressTile into size bytes at bits, returns false if the data doesn't expand to exactly that
+bool expandTile(const unsigned char* in, size_t n, unsigned char* bits, size_t size) {
+    size_t o = 0;
+    for (size_t i = 0; i < n; ) {
+        unsigned int c = in[i++];
+        if (c < 128) {
+            size_t len = c + 1;
+            if (i + len > n || o + len > size) {
+                return false;
+            }
+            memcpy(bits + o, in + i, len);
+            i += len;
+            o += len;
+        } else {
+            size_t len = c - 125;
+            if (i >= n || o + len > size) {
+                return false;
+            }
+            memset(bits + o, in[i++], len);
+            o += len;
+        }
+    }
+    return o == size;
+}
+
+bool seekFile(FILE* f, unsigned long long offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (long long)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Writes a tiled map one band of tileSize rows at a time, so converting a map never holds more than a band
+class TileWriter {
+public:
+    TileWriter() : f(NULL), height(0), width(0), tileSize(0), tilesAcross(0), numTiles(0) {}
+
+    ~TileWriter() {
+        if (f != NULL) {
+            fclose(f);
+            remove(temp.c_str());
+        }
+    }
+
+    bool open(const char* tilesPath, int h, int w, int size) {
+        if (h <= 0 || w <= 0 || size <= 0 || size % 8 != 0) {
+            return false;
+        }
+        path = tilesPath;
+        temp = path + ".tmp";
+        f = fopen(temp.c_str(), "wb");
+        if (f == NULL) {
+            return false;
+        }
+        height = h;
+        width = w;
+        tileSize = size;
+        tilesAcross = (width + tileSize - 1) / tileSize;
+        numTiles = (size_t)((height + tileSize - 1) / tileSize) * tilesAcross;
+        int header[4] = { height, width, tileSize, 0 };
+        fwrite(TILES_MAGIC, 1, sizeof(TILES_MAGIC), f);
+        fwrite(header, sizeof(int), 4, f);
+        offsets.assign(1, sizeof(TILES_MAGIC) + sizeof(header) + (numTiles + 1) * sizeof(unsigned long long));
+        std::vector<unsigned long long> table(numTiles + 1, 0); // Filled in by close
+        fwrite(&table[0], sizeof(unsigned long long), table.size(), f);
+        return true;
+    }
+
+    //Adds the next band of rows (tileSize of them, fewer for the last band), lit[i * width + j] non zero where lit
+    void addBand(const unsigned char* lit, int rows) {
+        std::vector<unsigned char> bits((size_t)tileSize * tileSize / 8);
+        for (int tc = 0; tc < tilesAcross; tc++) {
+            std::fill(bits.begin(), bits.end(), 0);
+            int y0 = tc * tileSize;
+            int cols = std::min(tileSize, width - y0);
+            for (int i = 0; i < rows; i++) {
+                const unsigned char* in = lit + (size_t)i * width + y0;
+                unsigned char* out = &bits[(size_t)i * tileSize / 8];
+                for (int j = 0; j < cols; j++) {
+                    out[j >> 3] |= (unsigned char)((in[j] != 0) << (j & 7));
+                }
+            }
+            std::vector<unsigned char> packed = compressTile(bits);
+            fwrite(&packed[0], 1, packed.size(), f);
+            offsets.push_back(offsets.back() + packed.size());
+        }
+    }
+
+    //Writes the offsets and renames the file into place, returns false if anything failed
+    bool close() {
+        bool ok = offsets.size() == numTiles + 1 && fseek(f, sizeof(TILES_MAGIC) + 4 * sizeof(int), SEEK_SET) == 0;
+        if (ok) {
+            fwrite(&offsets[0], sizeof(unsigned long long), offsets.size(), f);
+        }
+        ok = ok && ferror(f) == 0;
+        fclose(f);
+        f = NULL;
+        if (!ok) {
+            remove(temp.c_str());
+            return false;
+        }
+#ifdef _WIN32
+        remove(path.c_str()); // rename doesn't replace on Windows
+#endif
+        return rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+private:
+    FILE* f;
+    std::string path, temp;
+    int height, width, tileSize, tilesAcross;
+    size_t numTiles;
+    std::vector<unsigned long long> offsets;
+};
+
+//Tiles a grid where 0 is lit and 1 is shadowed, like buildFullLevel
+bool writeTiledMap(const char* path, const int* cells, int height, int width, int stride, int tileSize) {
+    TileWriter writer;
+    if (!writer.open(path, height, width, tileSize)) {
+        return false;
+    }
+    std::vector<unsigned char> band((size_t)tileSize * width);
+    for (int x0 = 0; x0 < height; x0 += tileSize) {
+        int rows = std::min(tileSize, height - x0);
+        for (int i = 0; i < rows; i++) {
+            const int* row = cells + (size_t)(x0 + i) * stride;
+            for (int j = 0; j < width; j++) {
+                band[(size_t)i * width + j] = (row[j] == 0);
+            }
+        }
+        writer.addBand(&band[0], rows);
+    }
+    return writer.close();
+}
+
+//Tiles a map written by saveMap, reading it a band at a time
+bool convertMapToTiles(const char* mapPath, const char* path, int tileSize) {
+    FILE* f = fopen(mapPath, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    char magic[8];
+    int dims[2];
+    TileWriter writer;
+    bool ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, MAP_MAGIC, sizeof(magic)) == 0
+            && fread(dims, sizeof(int), 2, f) == 2 && writer.open(path, dims[0], dims[1], tileSize);
+    if (ok) {
+        std::vector<unsigned char> band((size_t)tileSize * dims[1]);
+        for (int x0 = 0; x0 < dims[0] && ok; x0 += tileSize) {
+            int rows = std::min(tileSize, dims[0] - x0);
+            ok = fread(&band[0], 1, (size_t)rows * dims[1], f) == (size_t)rows * dims[1];
+            for (size_t k = 0; k < (size_t)rows * dims[1]; k++) { // Stored as shadowed
+                band[k] = (band[k] == 0);
+            }
+            if (ok) {
+                writer.addBand(&band[0], rows);
+            }
+        }
+    }
+    fclose(f);
+    return ok && writer.close();
+}
+
+struct TileCacheStats {
+    long long hits; // Tiles already in the cache when asked for, whether or not the prefetcher put them there
+    long long misses; // Read by the caller
+    long long waits; // Asked for while the prefetcher was still reading them
+    long long prefetched;
+    long long evictions;
+    long long bytesRead;
+};
+
+// A tiled map opened for reading. Tiles live in an LRU cache of packed bits, the ones a caller will want next can
+// be handed to a prefetch thread that reads them while the caller works on the current one. get and prefetch are
+// meant to be called from one thread
+class TiledMap {
+public:
+    typedef std::shared_ptr<const std::vector<unsigned char> > Tile; // Stays valid after it is evicted
+
+    int height, width, tileSize;
+    int tilesDown, tilesAcross;
+
+    TiledMap() : height(0), width(0), tileSize(0), tilesDown(0), tilesAcross(0), file(NULL), prefetchFile(NULL), capacity(0), stopping(false) {
+        memset(&counters, 0, sizeof(counters));
+    }
+
+    ~TiledMap() {
+        close();
+    }
+
+    //Opens the tiles at path with room for cacheBytes of them in memory, returns false if it isn't a tiled map
+    bool open(const char* path, size_t cacheBytes) {
+        close();
+        file = fopen(path, "rb");
+        prefetchFile = fopen(path, "rb");
+        char magic[8];
+        int header[4];
+        bool ok = file != NULL && prefetchFile != NULL && fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+                && memcmp(magic, TILES_MAGIC, sizeof(magic)) == 0 && fread(header, sizeof(int), 4, file) == 4
+                && header[0] > 0 && header[1] > 0 && header[2] > 0 && header[2] % 8 == 0;
+        if (ok) {
+            height = header[0];
+            width = header[1];
+            tileSize = header[2];
+            tilesDown = (height + tileSize - 1) / tileSize;
+            tilesAcross = (width + tileSize - 1) / tileSize;
+            offsets.resize((size_t)tilesDown * tilesAcross + 1);
+            ok = fread(&offsets[0], sizeof(unsigned long long), offsets.size(), file) == offsets.size();
+            for (size_t t = 1; t < offsets.size() && ok; t++) {
+                ok = offsets[t] >= offsets[t - 1];
+            }
+        }
+        if (!ok) {
+            close();
+            return false;
+        }
+        capacity = std::max(cacheBytes / tileBytes(), (size_t)TILE_PREFETCH_DEPTH + 2);
+        inFlight.assign(offsets.size() - 1, 0);
+        stopping = false;
+        worker = std::thread([this]() { run(); });
+        return true;
+    }
+
+    bool isOpen() const {
+        return file != NULL;
+    }
+
+    int numTiles() const {
+        return tilesDown * tilesAcross;
+    }
+
+    size_t tileBytes() const {
+        return (size_t)tileSize * tileSize / 8;
+    }
+
+    //Lit bit of cell (i, j) of a tile
+    unsigned char lit(const std::vector<unsigned char>& bits, int i, int j) const {
+        return (bits[(size_t)i * tileSize / 8 + (j >> 3)] >> (j & 7)) & 1;
+    }
+
+    //The bits of tile t, read now if the cache doesn't have them. Null if the file can't be read
+    Tile get(int t) {
+        std::unique_lock<std::mutex> lock(mutex);
+        bool waited = false;
+        while (true) {
+            std::unordered_map<int, Entry>::iterator it = cached.find(t);
+            if (it != cached.end()) {
+                order.splice(order.begin(), order, it->second.position);
+                counters.hits++;
+                return it->second.bits;
+            }
+            if (!inFlight[t]) { // Not cached and nobody is reading it (or the prefetcher failed to)
+                break;
+            }
+            if (!waited) {
+                counters.waits++;
+                waited = true;
+            }
+            arrived.wait(lock);
+        }
+        counters.misses++;
+        lock.unlock();
+        size_t bytes = 0;
+        Tile bits = read(file, t, bytes);
+        lock.lock();
+        counters.bytesRead += (long long)bytes;
+        if (bits) {
+            insert(t, bits);
+        }
+        return bits;
+    }
+
+    //Asks the prefetch thread to read tile t unless it is already cached or on its way
+    void prefetch(int t) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (t < 0 || t >= numTiles() || inFlight[t] || cached.count(t) != 0) {
+            return;
+        }
+        inFlight[t] = 1;
+        queue.push_back(t);
+        wake.notify_one();
+    }
+
+    TileCacheStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+    //Prints the cache's hit rate, nothing if no tile was asked for
+    void report(int world_rank) const {
+        TileCacheStats s = stats();
+        if (s.hits + s.misses == 0) {
+            return;
+        }
+        printf("Rank %d tile cache: %lld hits, %lld misses (%.1f%% hit rate), %lld prefetched, %lld waited on, %lld evicted, %.1f MB read \n", world_rank,
+                s.hits, s.misses, 100.0 * s.hits / (s.hits + s.misses), s.prefetched, s.waits, s.evictions, s.bytesRead / 1048576.0);
+    }
+
+    void close() {
+        if (worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                wake.notify_one();
+            }
+            worker.join();
+        }
+        if (file != NULL) {
+            fclose(file);
+            file = NULL;
+        }
+        if (prefetchFile != NULL) {
+            fclose(prefetchFile);
+            prefetchFile = NULL;
+        }
+        cached.clear();
+        order.clear();
+        queue.clear();
+    }
+
+private:
+    struct Entry {
+        Tile bits;
+        std::list<int>::iterator position;
+    };
+
+    FILE* file; // Read by the caller
+    FILE* prefetchFile; // Read by the prefetch thread
+    std::vector<unsigned long long> offsets;
+    size_t capacity; // In tiles
+    mutable std::mutex mutex;
+    std::condition_variable arrived; // A prefetched tile was read
+    std::condition_variable wake; // The prefetch thread has work
+    std::unordered_map<int, Entry> cached;
+    std::list<int> order; // Cached tiles, most recently used first
+    std::deque<int> queue; // Tiles to prefetch
+    std::vector<unsigned char> inFlight; // 1 while a tile is queued or being read by the prefetch thread
+    std::thread worker;
+    bool stopping;
+    TileCacheStats counters;
+
+    Tile read(FILE* f, int t, size_t& bytes) const {
+        bytes = (size_t)(offsets[t + 1] - offsets[t]);
+        std::vector<unsigned char> packed(bytes);
+        std::shared_ptr<std::vector<unsigned char> > bits(new std::vector<unsigned char>(tileBytes()));
+        if (!seekFile(f, offsets[t]) || (bytes > 0 && fread(&packed[0], 1, bytes, f) != bytes)
+                || !expandTile(packed.empty() ? NULL : &packed[0], bytes, &(*bits)[0], bits->size())) {
+            return Tile();
+        }
+        return bits;
+    }
+
+    //Adds a tile as the most recently used one, evicting the least recently used past capacity. Needs the lock
+    void insert(int t, const Tile& bits) {
+        if (cached.count(t) != 0) {
+            return;
+        }
+        order.push_front(t);
+        Entry e = { bits, order.begin() };
+        cached[t] = e;
+        while (cached.size() > capacity) {
+            cached.erase(order.back());
+            order.pop_back();
+            counters.evictions++;
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this]() { return !queue.empty() || stopping; });
+            if (stopping) {
+                return;
+            }
+            int t = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            size_t bytes = 0;
+            Tile bits = read(prefetchFile, t, bytes);
+            lock.lock();
+            counters.bytesRead += (long long)bytes;
+            if (bits) {
+                insert(t, bits);
+                counters.prefetched++;
+            }
+            inFlight[t] = 0;
+            arrived.notify_all();
+        }
+    }
+};
+
+//Builds the 1/16 and 1/4 levels from the tiles in one pass over them, returned coarsest first like buildLitPyramid.
+//The full resolution level only gets its size, its cells stay on disk. Empty if a tile can't be read
+std::vector<LitLevel> buildTiledPyramid(TiledMap& tiles) {
+    TRACE_SCOPE("buildTiledPyramid");
+    std::vector<LitLevel> levels(3);
+    LitLevel& full = levels[2];
+    full.factor = 1;
+    full.height = tiles.height;
+    full.width = tiles.width;
+    LitLevel& mid = levels[1];
+    mid.factor = 4;
+    mid.height = (full.height + 3) / 4;
+    mid.width = (full.width + 3) / 4;
+    mid.anyLit.assign((size_t)mid.height * mid.width, 0);
+    mid.allLit.assign((size_t)mid.height * mid.width, 1);
+    for (int t = 0; t < tiles.numTiles(); t++) {
+        for (int p = t + 1; p <= t + TILE_PREFETCH_DEPTH; p++) {
+            tiles.prefetch(p);
+        }
+        TiledMap::Tile bits = tiles.get(t);
+        if (!bits) {
+            return std::vector<LitLevel>();
+        }
+        int x0 = (t / tiles.tilesAcross) * tiles.tileSize;
+        int y0 = (t % tiles.tilesAcross) * tiles.tileSize;
+        int rows = std::min(tiles.tileSize, full.height - x0);
+        int cols = std::min(tiles.tileSize, full.width - y0);
+        for (int i = 0; i < rows; i++) {
+            unsigned char* anyOut = &mid.anyLit[(size_t)((x0 + i) / 4) * mid.width];
+            unsigned char* allOut = &mid.allLit[(size_t)((x0 + i) / 4) * mid.width];
+            for (int j = 0; j < cols; j++) {
+                unsigned char b = tiles.lit(*bits, i, j);
+                anyOut[(y0 + j) / 4] |= b;
+                allOut[(y0 + j) / 4] &= b;
+            }
+        }
+    }
+    levels[0] = downsampleLevel(mid, 4);
+    return levels;
+}
+
+// The part of a level under a corridor: its bounding box, with the lit cells inside the corridor (every
+// other cell 0) and the corridor itself in window coordinates
+struct TiledWindow {
+    int row0, col0; // Cell of the level at the top left of the window
+    LitLevel level;
+    std::vector<unsigned char> corridor;
+};
+
+// Largest window refinePath searches. With the grid and search state a window cell takes about 15 bytes, so this is ~1 GB
+const long long MAX_WINDOW_CELLS = 64LL << 20;
+
+//Sizes window to the bounding box of the corridor of radius (in coarse cells) around coarsePath over a level of
+//height x width cells, and marks the corridor. Returns false, without allocating, if the box is over MAX_WINDOW_CELLS
+bool frameWindow(const LitLevel& coarse, const std::vector<std::pair<int, int> >& coarsePath, int radius, int height, int width, TiledWindow& window) {
+    int ratio = coarse.factor / window.level.factor;
+    int x0 = coarse.height, x1 = -1, y0 = coarse.width, y1 = -1; // Bounding box in coarse cells
+    for (size_t p = 0; p < coarsePath.size(); p++) {
+        x0 = std::min(x0, std::max(coarsePath[p].first - radius, 0));
+        x1 = std::max(x1, std::min(coarsePath[p].first + radius, coarse.height - 1));
+        y0 = std::min(y0, std::max(coarsePath[p].second - radius, 0));
+        y1 = std::max(y1, std::min(coarsePath[p].second + radius, coarse.width - 1));
+    }
+    if (x1 < x0 || y1 < y0) {
+        return false;
+    }
+    window.row0 = x0 * ratio;
+    window.col0 = y0 * ratio;
+    LitLevel& level = window.level;
+    level.height = std::min((x1 + 1) * ratio, height) - window.row0;
+    level.width = std::min((y1 + 1) * ratio, width) - window.col0;
+    if ((long long)level.height * level.width > MAX_WINDOW_CELLS) {
+        printf("A corridor of radius %d needs a %d x %d window, over the %lld cell budget \n", radius, level.height, level.width, MAX_WINDOW_CELLS);
+        return false;
+    }
+    level.anyLit.assign((size_t)level.height * level.width, 0);
+    level.allLit = Raster<unsigned char>();
+    level.cost = Raster<unsigned char>();
+    std::vector<unsigned char> mask = corridorMask(coarse, coarsePath, radius);
+    window.corridor.resize((size_t)level.height * level.width);
+    for (int i = 0; i < level.height; i++) {
+        const unsigned char* coarseRow = &mask[(size_t)((window.row0 + i) / ratio) * coarse.width];
+        unsigned char* out = &window.corridor[(size_t)i * level.width];
+        for (int j = 0; j < level.width; j++) {
+            out[j] = coarseRow[(window.col0 + j) / ratio];
+        }
+    }
+    return true;
+}
+
+//Copies the window of fine under the corridor of radius (in coarse cells) around coarsePath, for a level that is in memory.
+//Returns false if the window is over budget
+bool cutWindow(const LitLevel& fine, const LitLevel& coarse, const std::vector<std::pair<int, int> >& coarsePath, int radius, TiledWindow& window) {
+    window.level.factor = fine.factor;
+    if (!frameWindow(coarse, coarsePath, radius, fine.height, fine.width, window)) {
+        return false;
+    }
+    LitLevel& level = window.level;
+    if (!fine.cost.empty()) {
+        level.cost.assign((size_t)level.height * level.width, 0);
+    }
+    for (int i = 0; i < level.height; i++) {
+        size_t in = (size_t)(window.row0 + i) * fine.width + window.col0;
+        size_t out = (size_t)i * level.width;
+        for (int j = 0; j < level.width; j++) {
+            if (window.corridor[out + j]) {
+                level.anyLit[out + j] = fine.anyLit[in + j];
+                if (!fine.cost.empty()) {
+                    level.cost[out + j] = fine.cost[in + j];
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//Reads the window of the full level under the corridor of radius (in coarse cells) around coarsePath. Only the tiles
+//the corridor touches are read, in the order the path reaches them, the next few prefetched while one is unpacked.
+//Returns false if the window is over budget or a tile can't be read
+bool readTiledWindow(TiledMap& tiles, const LitLevel& coarse, const std::vector<std::pair<int, int> >& coarsePath, int radius, TiledWindow& window) {
+    TRACE_SCOPE("readTiledWindow");
+    int ratio = coarse.factor;
+    window.level.factor = 1;
+    if (!frameWindow(coarse, coarsePath, radius, tiles.height, tiles.width, window)) {
+        return false;
+    }
+    LitLevel& level = window.level;
+
+    std::vector<int> wanted; // Tiles under the corridor in the order the path reaches them
+    std::vector<unsigned char> listed(tiles.numTiles(), 0);
+    for (size_t p = 0; p < coarsePath.size(); p++) {
+        int r0 = std::max(coarsePath[p].first - radius, 0) * ratio / tiles.tileSize;
+        int r1 = std::min((std::min(coarsePath[p].first + radius, coarse.height - 1) + 1) * ratio, tiles.height) - 1;
+        int c0 = std::max(coarsePath[p].second - radius, 0) * ratio / tiles.tileSize;
+        int c1 = std::min((std::min(coarsePath[p].second + radius, coarse.width - 1) + 1) * ratio, tiles.width) - 1;
+        for (int tr = r0; tr <= r1 / tiles.tileSize; tr++) {
+            for (int tc = c0; tc <= c1 / tiles.tileSize; tc++) {
+                int t = tr * tiles.tilesAcross + tc;
+                if (!listed[t]) {
+                    listed[t] = 1;
+                    wanted.push_back(t);
+                }
+            }
+        }
+    }
+    for (size_t k = 0; k < wanted.size(); k++) {
+        for (size_t p = k + 1; p <= k + TILE_PREFETCH_DEPTH && p < wanted.size(); p++) {
+            tiles.prefetch(wanted[p]);
+        }
+        TiledMap::Tile bits = tiles.get(wanted[k]);
+        if (!bits) {
+            return false;
+        }
+        int tx = (wanted[k] / tiles.tilesAcross) * tiles.tileSize;
+        int ty = (wanted[k] % tiles.tilesAcross) * tiles.tileSize;
+        int i0 = std::max(tx, window.row0), i1 = std::min(tx + tiles.tileSize, window.row0 + level.height);
+        int j0 = std::max(ty, window.col0), j1 = std::min(ty + tiles.tileSize, window.col0 + level.width);
+        for (int i = i0; i < i1; i++) {
+            size_t row = (size_t)(i - window.row0) * level.width - window.col0;
+            for (int j = j0; j < j1; j++) {
+                if (window.corridor[row + j]) {
+                    level.anyLit[row + j] = tiles.lit(*bits, i - tx, j - ty);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+#endif